@@ -1,19 +1,35 @@
 //#define WITHOUT_ASIO 1
 
 #include <thread_pool.hpp>
+#include <submission_buffer.hpp>
+#include <mutex_thread_pool.hpp>
+#include <memory_probe.hpp>
 
 #ifndef WITHOUT_ASIO
 #include <asio_thread_pool.hpp>
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 #include <thread>
 #include <vector>
 #include <future>
+#include <utility>
 
 static const size_t CONCURRENCY = 16;
 static const size_t REPOST_COUNT = 1000000;
+static const size_t PRODUCER_POST_COUNT = 1000000;
+static const size_t MATRIX_TASK_COUNT = 200000;
+static const size_t MATRIX_TREE_DEPTH = 16;
+static const size_t COMPARISON_TASK_COUNT = 100000;
+static const size_t COMPARISON_TREE_DEPTH = 16;
+static const size_t ASYNC_TASK_COUNT = 1000;
+static const size_t ASYNC_TREE_DEPTH = 8;
 
 struct Heavy {
     bool verbose;
@@ -75,6 +91,16 @@ struct Heavy {
 };
 
 
+struct Measurement {
+    double time;
+    MemoryReport memory;
+};
+
+std::ostream & operator<<(std::ostream &stream, const Measurement &measurement)
+{
+    return stream << measurement.time << " (" << measurement.memory << ")";
+}
+
 struct RepostJob {
     //Heavy heavy;
 
@@ -135,6 +161,454 @@ struct RepostJob {
     }
 };
 
+template <typename Post>
+void producerPost(const char *name, Post &&post)
+{
+    std::atomic<size_t> done{0};
+
+    MemoryProbe probe;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < PRODUCER_POST_COUNT; ++i) {
+        while (!post([&done](size_t) { done.fetch_add(1, std::memory_order_relaxed); })) {
+            std::this_thread::yield();
+        }
+    }
+    while (done.load() < PRODUCER_POST_COUNT) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::cout << name << ": posted " << PRODUCER_POST_COUNT << " in "
+              << std::chrono::duration<double, std::milli>(end - begin).count() << " ms"
+              << " (" << probe.report(PRODUCER_POST_COUNT) << ")" << std::endl;
+}
+
+static void busyWork(size_t iterations)
+{
+    volatile size_t sink = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = sink + i;
+    }
+}
+
+template <typename Handler>
+static void postOrRun(ThreadPool &thread_pool, Handler &&handler)
+{
+    try {
+        thread_pool.post(std::forward<Handler>(handler));
+    } catch (const std::overflow_error &) {
+        handler(0);
+    }
+}
+
+template <typename Workload>
+static Measurement measure(BalancingStrategy strategy, Workload &&workload)
+{
+    ThreadPoolOptions options;
+    options.balancing = strategy;
+    options.worker_queue_size = 1 << 16;
+    ThreadPool thread_pool{options};
+
+    std::atomic<size_t> done{0};
+    MemoryProbe probe;
+    auto begin = std::chrono::high_resolution_clock::now();
+    size_t expected = workload(thread_pool, done);
+    while (done.load() < expected) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return Measurement{std::chrono::duration<double, std::milli>(end - begin).count(),
+                       probe.report(expected)};
+}
+
+struct TreeJob {
+    ThreadPool *thread_pool;
+    std::atomic<size_t> *done;
+    size_t depth;
+
+    void operator()(size_t)
+    {
+        if (depth < MATRIX_TREE_DEPTH) {
+            postOrRun(*thread_pool, TreeJob{thread_pool, done, depth + 1});
+            postOrRun(*thread_pool, TreeJob{thread_pool, done, depth + 1});
+        } else {
+            busyWork(100);
+        }
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct ChainJob {
+    ThreadPool *thread_pool;
+    std::atomic<size_t> *done;
+    size_t left;
+
+    void operator()(size_t)
+    {
+        done->fetch_add(1, std::memory_order_relaxed);
+        if (left != 0) {
+            postOrRun(*thread_pool, ChainJob{thread_pool, done, left - 1});
+        }
+    }
+};
+
+static void balancingMatrix()
+{
+    std::cout << "***balancing strategies (ms, allocations and peak RSS)***" << std::endl;
+
+    const std::pair<const char *, BalancingStrategy> strategies[] = {
+        {"hybrid", BalancingStrategy::Hybrid},
+        {"stealing", BalancingStrategy::WorkStealing},
+        {"sharing", BalancingStrategy::WorkSharing},
+    };
+
+    std::cout << "strategy\trepost\texternal\tskewed\ttree" << std::endl;
+    for (const auto &strategy : strategies) {
+        Measurement repost = measure(strategy.second, [](ThreadPool &thread_pool, std::atomic<size_t> &done) {
+            const size_t chain = MATRIX_TASK_COUNT / CONCURRENCY;
+            for (size_t i = 0; i < CONCURRENCY; ++i) {
+                thread_pool.post(ChainJob{&thread_pool, &done, chain - 1});
+            }
+            return chain * CONCURRENCY;
+        });
+
+        Measurement external = measure(strategy.second, [](ThreadPool &thread_pool, std::atomic<size_t> &done) {
+            for (size_t i = 0; i < MATRIX_TASK_COUNT; ++i) {
+                postOrRun(thread_pool, [&done](size_t) {
+                    busyWork(100);
+                    done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            return MATRIX_TASK_COUNT;
+        });
+
+        Measurement skewed = measure(strategy.second, [](ThreadPool &thread_pool, std::atomic<size_t> &done) {
+            const size_t count = MATRIX_TASK_COUNT / 100;
+            for (size_t i = 0; i < count; ++i) {
+                postOrRun(thread_pool, [&done, i](size_t) {
+                    busyWork(i % 64 == 0 ? 200000 : 1000);
+                    done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            return count;
+        });
+
+        Measurement tree = measure(strategy.second, [](ThreadPool &thread_pool, std::atomic<size_t> &done) {
+            thread_pool.post(TreeJob{&thread_pool, &done, 0});
+            return (size_t(2) << MATRIX_TREE_DEPTH) - 1;
+        });
+
+        std::cout << strategy.first << "\t" << repost << "\t" << external
+                  << "\t" << skewed << "\t" << tree << std::endl;
+    }
+}
+
+static void urgentLatency()
+{
+    std::cout << "***urgent dispatch under bulk load (us)***" << std::endl;
+
+    ThreadPoolOptions options;
+    options.urgent_threads_count = 1;
+    ThreadPool thread_pool{options};
+
+    std::atomic<bool> stop{false};
+    for (size_t i = 0; i < thread_pool.getWorkerCount(); ++i) {
+        thread_pool.post([&stop](size_t) {
+            while (!stop.load(std::memory_order_relaxed)) {
+                busyWork(1000);
+            }
+        });
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(1000);
+    MemoryProbe probe;
+    for (size_t i = 0; i < 1000; ++i) {
+        std::atomic<bool> done{false};
+        auto begin = std::chrono::high_resolution_clock::now();
+        std::chrono::high_resolution_clock::time_point started;
+        thread_pool.postUrgent([&done, &started](size_t) {
+            started = std::chrono::high_resolution_clock::now();
+            done.store(true, std::memory_order_release);
+        });
+        while (!done.load(std::memory_order_acquire)) {
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(started - begin).count());
+    }
+    stop = true;
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "p50 " << latencies[latencies.size() / 2]
+              << " p99 " << latencies[latencies.size() * 99 / 100]
+              << " max " << latencies.back()
+              << " (" << probe.report(latencies.size()) << ")" << std::endl;
+}
+
+// Scenarios of the comparison, ran on every backend with equivalent code.
+// repost: CONCURRENCY chains of tasks, each task posts the next one.
+// fan-out: one producer posts independent tasks and waits for all of them.
+// fork-join: binary tree of tasks, leaves do the work and parents join children.
+// Pools have no blocking wait inside tasks, so there the join is a continuation
+// ran by the last finished child.
+
+template <typename Spawn>
+struct CompareChainJob {
+    Spawn *spawn;
+    std::atomic<size_t> *done;
+    size_t left;
+
+    void operator()()
+    {
+        done->fetch_add(1, std::memory_order_relaxed);
+        if (left != 0) {
+            (*spawn)(CompareChainJob{spawn, done, left - 1});
+        }
+    }
+};
+
+struct ForkJoin {
+    ForkJoin *parent;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> sum;
+
+    ForkJoin(ForkJoin *parent, size_t children)
+        : parent(parent)
+        , pending(children)
+        , sum(0)
+    {
+    }
+
+    static void complete(ForkJoin *join, size_t value)
+    {
+        while (true) {
+            join->sum.fetch_add(value);
+            if (join->pending.fetch_sub(1) != 1) {
+                return;
+            }
+            ForkJoin *parent = join->parent;
+            if (!parent) {
+                return;
+            }
+            value = join->sum.load();
+            delete join;
+            join = parent;
+        }
+    }
+};
+
+template <typename Spawn>
+struct ForkJoinJob {
+    Spawn *spawn;
+    ForkJoin *join;
+    size_t depth;
+
+    void operator()()
+    {
+        if (depth == 0) {
+            busyWork(100);
+            ForkJoin::complete(join, 1);
+            return;
+        }
+        ForkJoin *children = new ForkJoin(join, 2);
+        (*spawn)(ForkJoinJob{spawn, children, depth - 1});
+        (*spawn)(ForkJoinJob{spawn, children, depth - 1});
+    }
+};
+
+template <typename Func>
+static Measurement nsPerTask(size_t tasks, Func &&func)
+{
+    MemoryProbe probe;
+    auto begin = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return Measurement{std::chrono::duration<double, std::nano>(end - begin).count() / tasks,
+                       probe.report(tasks)};
+}
+
+static void waitFor(const std::atomic<size_t> &counter, size_t expected)
+{
+    while (counter.load() < expected) {
+        std::this_thread::yield();
+    }
+}
+
+template <typename Spawn>
+static void comparePool(const char *name, Spawn &spawn)
+{
+    Measurement repost = nsPerTask(COMPARISON_TASK_COUNT, [&spawn]() {
+        std::atomic<size_t> done{0};
+        const size_t chain = COMPARISON_TASK_COUNT / CONCURRENCY;
+        for (size_t i = 0; i < CONCURRENCY; ++i) {
+            spawn(CompareChainJob<Spawn>{&spawn, &done, chain - 1});
+        }
+        waitFor(done, chain * CONCURRENCY);
+    });
+
+    Measurement fan_out = nsPerTask(COMPARISON_TASK_COUNT, [&spawn]() {
+        std::atomic<size_t> done{0};
+        for (size_t i = 0; i < COMPARISON_TASK_COUNT; ++i) {
+            spawn([&done]() {
+                busyWork(100);
+                done.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        waitFor(done, COMPARISON_TASK_COUNT);
+    });
+
+    Measurement fork_join = nsPerTask((size_t(2) << COMPARISON_TREE_DEPTH) - 1, [&spawn]() {
+        ForkJoin root(nullptr, 1);
+        spawn(ForkJoinJob<Spawn>{&spawn, &root, COMPARISON_TREE_DEPTH});
+        while (root.pending.load() != 0) {
+            std::this_thread::yield();
+        }
+    });
+
+    std::cout << name << "\t" << repost << "\t" << fan_out << "\t" << fork_join << std::endl;
+}
+
+static size_t asyncForkJoin(size_t depth)
+{
+    if (depth == 0) {
+        busyWork(100);
+        return 1;
+    }
+    auto left = std::async(std::launch::async, asyncForkJoin, depth - 1);
+    auto right = std::async(std::launch::async, asyncForkJoin, depth - 1);
+    return left.get() + right.get();
+}
+
+static void compareAsync()
+{
+    Measurement repost = nsPerTask(ASYNC_TASK_COUNT, []() {
+        std::vector<std::future<void>> chains;
+        for (size_t i = 0; i < CONCURRENCY; ++i) {
+            chains.push_back(std::async(std::launch::async, []() {
+                for (size_t j = 0; j < ASYNC_TASK_COUNT / CONCURRENCY; ++j) {
+                    std::async(std::launch::async, []() {}).get();
+                }
+            }));
+        }
+        for (auto &chain : chains) {
+            chain.get();
+        }
+    });
+
+    Measurement fan_out = nsPerTask(ASYNC_TASK_COUNT, []() {
+        std::vector<std::future<void>> tasks;
+        for (size_t i = 0; i < ASYNC_TASK_COUNT; ++i) {
+            tasks.push_back(std::async(std::launch::async, []() { busyWork(100); }));
+        }
+        for (auto &task : tasks) {
+            task.get();
+        }
+    });
+
+    Measurement fork_join = nsPerTask((size_t(2) << ASYNC_TREE_DEPTH) - 1, []() {
+        asyncForkJoin(ASYNC_TREE_DEPTH);
+    });
+
+    std::cout << "std::async\t" << repost << "\t" << fan_out << "\t" << fork_join << std::endl;
+}
+
+#ifdef _OPENMP
+static void ompChain(std::atomic<size_t> *done, size_t left)
+{
+    done->fetch_add(1, std::memory_order_relaxed);
+    if (left != 0) {
+        #pragma omp task
+        ompChain(done, left - 1);
+    }
+}
+
+static size_t ompForkJoin(size_t depth)
+{
+    if (depth == 0) {
+        busyWork(100);
+        return 1;
+    }
+    size_t left = 0;
+    size_t right = 0;
+    #pragma omp task shared(left)
+    left = ompForkJoin(depth - 1);
+    #pragma omp task shared(right)
+    right = ompForkJoin(depth - 1);
+    #pragma omp taskwait
+    return left + right;
+}
+
+static void compareOpenMP()
+{
+    Measurement repost = nsPerTask(COMPARISON_TASK_COUNT, []() {
+        std::atomic<size_t> done{0};
+        const size_t chain = COMPARISON_TASK_COUNT / CONCURRENCY;
+        #pragma omp parallel
+        #pragma omp single
+        #pragma omp taskgroup
+        {
+            for (size_t i = 0; i < CONCURRENCY; ++i) {
+                #pragma omp task
+                ompChain(&done, chain - 1);
+            }
+        }
+    });
+
+    Measurement fan_out = nsPerTask(COMPARISON_TASK_COUNT, []() {
+        #pragma omp parallel
+        #pragma omp single
+        {
+            for (size_t i = 0; i < COMPARISON_TASK_COUNT; ++i) {
+                #pragma omp task
+                busyWork(100);
+            }
+            #pragma omp taskwait
+        }
+    });
+
+    Measurement fork_join = nsPerTask((size_t(2) << COMPARISON_TREE_DEPTH) - 1, []() {
+        #pragma omp parallel
+        #pragma omp single
+        ompForkJoin(COMPARISON_TREE_DEPTH);
+    });
+
+    std::cout << "openmp\t" << repost << "\t" << fan_out << "\t" << fork_join << std::endl;
+}
+#endif
+
+static void comparison()
+{
+    std::cout << "***comparison (ns per task, allocations and peak RSS)***" << std::endl;
+    std::cout << "backend\trepost\tfan-out\tfork-join" << std::endl;
+
+    {
+        ThreadPoolOptions options;
+        options.worker_queue_size = 1 << 16;
+        ThreadPool thread_pool{options};
+        auto spawn = [&thread_pool](auto &&job) {
+            postOrRun(thread_pool, [job](size_t) mutable { job(); });
+        };
+        comparePool("thread pool cpp", spawn);
+    }
+
+    {
+        size_t workers_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        MutexThreadPool mutex_thread_pool(workers_count);
+        auto spawn = [&mutex_thread_pool](auto &&job) {
+            mutex_thread_pool.post(std::forward<decltype(job)>(job));
+        };
+        comparePool("mutex pool", spawn);
+    }
+
+    compareAsync();
+
+#ifdef _OPENMP
+    compareOpenMP();
+#else
+    std::cout << "openmp\tnot available" << std::endl;
+#endif
+}
+
 int main(int, const char *[])
 {
     std::cout << "Benchmark job reposting" << std::endl;
@@ -144,6 +618,7 @@ int main(int, const char *[])
 
         std::promise<void> waiters[CONCURRENCY];
         ThreadPool thread_pool;
+        MemoryProbe probe;
         for (auto &waiter : waiters) {
             thread_pool.post(RepostJob(&thread_pool, &waiter));
         }
@@ -151,8 +626,40 @@ int main(int, const char *[])
         for (auto &waiter : waiters) {
             waiter.get_future().wait();
         }
+        std::cout << "memory: " << probe.report(CONCURRENCY * (REPOST_COUNT + 1)) << std::endl;
+    }
+
+    {
+        std::cout << "***thread pool cpp producer posting***" << std::endl;
+
+        ThreadPool thread_pool;
+        producerPost("post", [&thread_pool](auto &&handler) {
+            try {
+                thread_pool.post(std::move(handler));
+                return true;
+            } catch (const std::overflow_error &) {
+                return false;
+            }
+        });
+
+        SubmissionBuffer buffer(thread_pool);
+        producerPost("submission buffer", [&buffer](auto &&handler) {
+            try {
+                buffer.post(std::move(handler));
+                buffer.flushIfExpired();
+                return true;
+            } catch (const std::overflow_error &) {
+                return false;
+            }
+        });
     }
 
+    balancingMatrix();
+
+    urgentLatency();
+
+    comparison();
+
 #ifndef WITHOUT_ASIO
     {
         std::cout << "***asio thread pool***" << std::endl;
@@ -165,6 +672,7 @@ int main(int, const char *[])
         AsioThreadPool asio_thread_pool(workers_count);
 
         std::promise<void> waiters[CONCURRENCY];
+        MemoryProbe probe;
         for (auto &waiter : waiters) {
             asio_thread_pool.post(RepostJob(&asio_thread_pool, &waiter));
         }
@@ -172,6 +680,7 @@ int main(int, const char *[])
         for (auto &waiter : waiters) {
             waiter.get_future().wait();
         }
+        std::cout << "memory: " << probe.report(CONCURRENCY * (REPOST_COUNT + 1)) << std::endl;
     }
 #endif
 
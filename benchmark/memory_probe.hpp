@@ -0,0 +1,198 @@
+#ifndef MEMORY_PROBE_HPP
+#define MEMORY_PROBE_HPP
+
+// Replaces the global operator new and operator delete to count allocations,
+// so it should be included by exactly one translation unit of a program.
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief The AllocationCounter class counts allocations made through the global
+ * operator new. Threads add to one of several cache line sized slots, so counting
+ * doesn't make all allocating threads contend on one atomic.
+ */
+class AllocationCounter {
+public:
+    static void add(size_t bytes);
+
+    static size_t getAllocations();
+    static size_t getBytes();
+
+private:
+    static const size_t Slots = 64;
+
+    struct Slot {
+        std::atomic<size_t> allocations;
+        std::atomic<size_t> bytes;
+        char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+    };
+
+    static Slot * slots();
+};
+
+/**
+ * @brief The MemoryReport struct holds allocation costs of a benchmark scenario.
+ */
+struct MemoryReport {
+    double allocations_per_task;
+    double bytes_per_task;
+    size_t peak_rss_kb;
+};
+
+/**
+ * @brief The MemoryProbe class measures allocations and the resident memory
+ * high-water mark of the process from its construction.
+ */
+class MemoryProbe {
+public:
+    /**
+     * @brief MemoryProbe Constructor. Resets the resident memory high-water mark.
+     */
+    MemoryProbe();
+
+    /**
+     * @brief report Returns allocations made since construction divided by tasks
+     * and the peak resident memory.
+     */
+    MemoryReport report(size_t tasks) const;
+
+    /**
+     * @brief getPeakRss Returns VmHWM of the process in KB or 0 if it is unknown.
+     */
+    static size_t getPeakRss();
+
+    /**
+     * @brief resetPeakRss Reset VmHWM of the process to its current resident memory.
+     * Does nothing when the kernel doesn't allow it.
+     */
+    static void resetPeakRss();
+
+private:
+    size_t m_allocations;
+    size_t m_bytes;
+};
+
+std::ostream & operator<<(std::ostream &stream, const MemoryReport &report);
+
+
+/// Implementation
+
+inline AllocationCounter::Slot * AllocationCounter::slots() {
+    static Slot slots[Slots];
+    return slots;
+}
+
+inline void AllocationCounter::add(size_t bytes) {
+    static std::atomic<size_t> next_slot{0};
+    static thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % Slots;
+    slots()[slot].allocations.fetch_add(1, std::memory_order_relaxed);
+    slots()[slot].bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline size_t AllocationCounter::getAllocations() {
+    size_t allocations = 0;
+    for (size_t i = 0; i < Slots; ++i) {
+        allocations += slots()[i].allocations.load(std::memory_order_relaxed);
+    }
+    return allocations;
+}
+
+inline size_t AllocationCounter::getBytes() {
+    size_t bytes = 0;
+    for (size_t i = 0; i < Slots; ++i) {
+        bytes += slots()[i].bytes.load(std::memory_order_relaxed);
+    }
+    return bytes;
+}
+
+inline MemoryProbe::MemoryProbe() {
+    resetPeakRss();
+    m_allocations = AllocationCounter::getAllocations();
+    m_bytes = AllocationCounter::getBytes();
+}
+
+inline MemoryReport MemoryProbe::report(size_t tasks) const {
+    size_t allocations = AllocationCounter::getAllocations() - m_allocations;
+    size_t bytes = AllocationCounter::getBytes() - m_bytes;
+    if (tasks == 0) {
+        tasks = 1;
+    }
+    return MemoryReport{static_cast<double>(allocations) / tasks,
+                        static_cast<double>(bytes) / tasks, getPeakRss()};
+}
+
+inline size_t MemoryProbe::getPeakRss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+inline void MemoryProbe::resetPeakRss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+}
+
+inline std::ostream & operator<<(std::ostream &stream, const MemoryReport &report) {
+    return stream << report.allocations_per_task << " allocs/task "
+                  << report.bytes_per_task << " B/task peak "
+                  << report.peak_rss_kb << " KB";
+}
+
+void * operator new(size_t size) {
+    AllocationCounter::add(size);
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void * operator new[](size_t size) {
+    return operator new(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+    AllocationCounter::add(size);
+    return std::malloc(size ? size : 1);
+}
+
+void * operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+    return operator new(size, tag);
+}
+
+// Deallocation functions are not inlined, otherwise GCC diagnoses free() of
+// pointers it sees coming from operator new.
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MUTEX_THREAD_POOL_HPP
+#define MUTEX_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The MutexThreadPool class is a naive thread pool: one std::deque of
+ * std::function guarded by a mutex, with idle workers sleeping on a condition
+ * variable. It is the baseline for the benchmark comparison.
+ */
+class MutexThreadPool
+{
+public:
+    inline MutexThreadPool(size_t threads);
+
+    inline ~MutexThreadPool()
+    {
+        stop();
+    }
+
+    template <typename Handler>
+    inline void post(Handler &&handler)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.emplace_back(std::forward<Handler>(handler));
+        }
+        m_condition.notify_one();
+    }
+
+private:
+    inline void stop();
+    inline void worker_thread_func();
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stopped;
+
+    std::vector<std::thread> m_threads;
+};
+
+inline MutexThreadPool::MutexThreadPool(size_t threads)
+    : m_stopped(false)
+    , m_threads(threads)
+{
+    for (auto &i : m_threads)
+    {
+        i = std::thread(&MutexThreadPool::worker_thread_func, this);
+    }
+}
+
+inline void MutexThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+    m_condition.notify_all();
+
+    for (auto &i : m_threads)
+    {
+        if (i.joinable())
+        {
+            i.join();
+        }
+    }
+}
+
+inline void MutexThreadPool::worker_thread_func()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopped || !m_tasks.empty(); });
+            if (m_tasks.empty())
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include <pool_simulator.hpp>
+#include <trace_recorder.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const size_t SIMULATED_TASK_COUNT = 200000;
+static const size_t SIMULATED_WORKERS_COUNT = 8;
+static const uint32_t SIMULATED_TREE_DEPTH = 14;
+
+/**
+ * @brief Xorshift generator, so workloads don't depend on the standard library.
+ */
+struct Random {
+    uint64_t state;
+
+    uint64_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+static std::vector<SimulatedTask> uniformWorkload()
+{
+    Random random{42};
+    std::vector<SimulatedTask> workload(SIMULATED_TASK_COUNT);
+    uint64_t time = 0;
+    for (auto &task : workload) {
+        time += random.next() % 400;
+        task.arrival = time;
+        task.duration = 1000 + random.next() % 500;
+    }
+    return workload;
+}
+
+static std::vector<SimulatedTask> skewedWorkload()
+{
+    Random random{42};
+    std::vector<SimulatedTask> workload(SIMULATED_TASK_COUNT / 10);
+    uint64_t time = 0;
+    for (size_t i = 0; i < workload.size(); ++i) {
+        time += random.next() % 4000;
+        workload[i].arrival = time;
+        workload[i].duration = i % 64 == 0 ? 1000000 : 5000;
+    }
+    return workload;
+}
+
+static std::vector<SimulatedTask> burstWorkload()
+{
+    std::vector<SimulatedTask> workload(SIMULATED_TASK_COUNT);
+    for (size_t i = 0; i < workload.size(); ++i) {
+        workload[i].arrival = (i / 10000) * 20000000;
+        workload[i].duration = 10000;
+    }
+    return workload;
+}
+
+static std::vector<SimulatedTask> treeWorkload()
+{
+    SimulatedTask root;
+    root.duration = 2000;
+    root.fanout = 2;
+    root.depth = SIMULATED_TREE_DEPTH;
+    return {root};
+}
+
+static void simulate(const char *name, const std::vector<SimulatedTask> &workload)
+{
+    std::cout << "***" << name << "***" << std::endl;
+
+    const std::pair<const char *, BalancingStrategy> strategies[] = {
+        {"hybrid", BalancingStrategy::Hybrid},
+        {"stealing", BalancingStrategy::WorkStealing},
+        {"sharing", BalancingStrategy::WorkSharing},
+    };
+
+    std::cout << "strategy\tmakespan ms\tutilization\tstart p50 us\tp99 us\tsojourn p99 us"
+              << "\tsteals\tfailed steals\trejected" << std::endl;
+    for (const auto &strategy : strategies) {
+        SimulatorOptions options;
+        options.workers_count = SIMULATED_WORKERS_COUNT;
+        options.worker_queue_size = 1 << 16;
+        options.balancing = strategy.second;
+
+        PoolSimulator simulator(options);
+        SimulatorReport report = simulator.run(workload);
+
+        std::cout << strategy.first << "\t" << report.makespan / 1e6
+                  << "\t" << report.utilization
+                  << "\t" << report.start_p50 / 1e3
+                  << "\t" << report.start_p99 / 1e3
+                  << "\t" << report.sojourn_p99 / 1e3
+                  << "\t" << report.steals
+                  << "\t" << report.failed_steals
+                  << "\t" << report.rejected << std::endl;
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc > 1) {
+        auto trace = TraceRecorder::load(argv[1]);
+        simulate(argv[1], PoolSimulator::fromTrace(trace, 1000));
+        return 0;
+    }
+
+    simulate("uniform", uniformWorkload());
+    simulate("skewed", skewedWorkload());
+    simulate("bursts", burstWorkload());
+    simulate("tree", treeWorkload());
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <thread_pool.hpp>
+#include <trace_recorder.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const size_t SYNTHETIC_TASK_COUNT = 100000;
+static const char *SYNTHETIC_TRACE_PATH = "trace_replay.trace";
+
+static void busyWork(size_t iterations)
+{
+    volatile size_t sink = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = sink + i;
+    }
+}
+
+static void spinFor(uint64_t nanoseconds)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(nanoseconds);
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+template <typename Handler>
+static void postRetrying(ThreadPool &thread_pool, Handler &&handler, uint16_t tag)
+{
+    while (true) {
+        try {
+            thread_pool.post(std::forward<Handler>(handler), tag);
+            return;
+        } catch (const std::overflow_error &) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void recordSynthetic(const std::string &path)
+{
+    ThreadPoolOptions options;
+    options.trace_path = path;
+    options.worker_queue_size = 1 << 16;
+    ThreadPool thread_pool{options};
+
+    std::atomic<size_t> done{0};
+    for (size_t i = 0; i < SYNTHETIC_TASK_COUNT; ++i) {
+        const uint16_t tag = i % 64 == 0 ? 1 : 0;
+        postRetrying(thread_pool, [&done, tag](size_t) {
+            busyWork(tag ? 100000 : 1000);
+            done.fetch_add(1, std::memory_order_relaxed);
+        }, tag);
+        if (i % 1000 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    while (done.load() < SYNTHETIC_TASK_COUNT) {
+        std::this_thread::yield();
+    }
+}
+
+static double percentile(std::vector<uint64_t> &values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+static void replay(const std::vector<TraceRecord> &trace, const char *name, BalancingStrategy strategy)
+{
+    std::vector<uint64_t> measured;
+    for (const auto &record : trace) {
+        if (record.duration != TraceRecord::Unmeasured) {
+            measured.push_back(record.duration);
+        }
+    }
+    uint64_t median = 0;
+    if (!measured.empty()) {
+        std::nth_element(measured.begin(), measured.begin() + measured.size() / 2, measured.end());
+        median = measured[measured.size() / 2];
+    }
+
+    ThreadPoolOptions options;
+    options.balancing = strategy;
+    options.worker_queue_size = 1 << 16;
+    ThreadPool thread_pool{options};
+
+    std::vector<uint64_t> latencies(trace.size());
+    std::atomic<size_t> done{0};
+    const uint64_t first = trace.empty() ? 0 : trace.front().post_time;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < trace.size(); ++i) {
+        const TraceRecord &record = trace[i];
+        auto arrival = begin + std::chrono::nanoseconds(record.post_time - first);
+        while (std::chrono::steady_clock::now() < arrival) {
+        }
+
+        const uint64_t duration = record.duration != TraceRecord::Unmeasured ? record.duration : median;
+        auto posted = std::chrono::steady_clock::now();
+        postRetrying(thread_pool, [&latencies, &done, i, duration, posted](size_t) {
+            latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - posted).count();
+            spinFor(duration);
+            done.fetch_add(1, std::memory_order_relaxed);
+        }, record.tag);
+    }
+    while (done.load() < trace.size()) {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << name << "\t" << std::chrono::duration<double, std::milli>(end - begin).count()
+              << "\t" << percentile(latencies, 0.5)
+              << "\t" << percentile(latencies, 0.99)
+              << "\t" << percentile(latencies, 1.0) << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+    std::string path;
+    if (argc > 1) {
+        path = argv[1];
+    } else {
+        std::cout << "recording synthetic trace to " << SYNTHETIC_TRACE_PATH << std::endl;
+        path = SYNTHETIC_TRACE_PATH;
+        recordSynthetic(path);
+    }
+
+    auto trace = TraceRecorder::load(path);
+    std::sort(trace.begin(), trace.end(), [](const TraceRecord &a, const TraceRecord &b) {
+        return a.post_time < b.post_time;
+    });
+    std::cout << "replaying " << trace.size() << " tasks from " << path << std::endl;
+
+    const std::pair<const char *, BalancingStrategy> strategies[] = {
+        {"hybrid", BalancingStrategy::Hybrid},
+        {"stealing", BalancingStrategy::WorkStealing},
+        {"sharing", BalancingStrategy::WorkSharing},
+    };
+
+    std::cout << "strategy\tmakespan ms\tstart p50 us\tp99 us\tmax us" << std::endl;
+    for (const auto &strategy : strategies) {
+        if (argc > 2 && 0 != std::strcmp(argv[2], strategy.first)) {
+            continue;
+        }
+        replay(trace, strategy.first, strategy.second);
+    }
+
+    return 0;
+}
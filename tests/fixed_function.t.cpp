@@ -5,6 +5,7 @@
 #include <cassert>
 #include <type_traits>
 #include <functional>
+#include <memory>
 
 int test_free_func(int i)
 {
@@ -140,6 +141,45 @@ int main()
         ASSERT(2 == f(1));
     });
 
+    doTest("move assignment releases previous object", []() {
+        auto p1 = std::make_shared<int>(1);
+        auto p2 = std::make_shared<int>(2);
+        std::weak_ptr<int> w1 = p1;
+
+        FixedFunction<int()> f1([p1 = std::move(p1)]() { return *p1; });
+        FixedFunction<int()> f2([p2 = std::move(p2)]() { return *p2; });
+        f1 = std::move(f2);
+
+        ASSERT(w1.expired());
+        ASSERT(2 == f1());
+    });
+
+    doTest("move free func", []() {
+        FixedFunction<int(int)> f1(test_free_func);
+        FixedFunction<int(int)> f2(std::move(f1));
+        FixedFunction<int(int)> f3;
+        f3 = std::move(f2);
+        ASSERT(5 == f3(5));
+    });
+
+    doTest("move assignment between free func and lambda", []() {
+        auto p = std::make_shared<int>(7);
+        std::weak_ptr<int> w = p;
+
+        FixedFunction<int(int)> f(test_free_func);
+        FixedFunction<int(int)> g([p = std::move(p)](int i) { return *p + i; });
+        f = std::move(g);
+        ASSERT(8 == f(1));
+
+        FixedFunction<int(int)> h(test_free_func);
+        f = std::move(h);
+        ASSERT(w.expired());
+        ASSERT(3 == f(3));
+
+        f = std::move(f);
+        ASSERT(4 == f(4));
+    });
+
     doTest("lambda", []() {
         const std::string s1 = "s1";
         FixedFunction<std::string()> f([&s1]() {
@@ -149,6 +189,26 @@ int main()
         ASSERT(s1 == f());
     });
 
+    doTest("prefetch", []() {
+        struct Prefetching {
+            int *prefetched;
+            void prefetch() { ++*prefetched; }
+            int operator()() { return *prefetched; }
+        };
+
+        int prefetched = 0;
+        FixedFunction<int()> f1(Prefetching{&prefetched});
+        FixedFunction<int()> f2(std::move(f1));
+        f2.prefetch();
+        ASSERT(1 == f2());
+
+        FixedFunction<int(int)> f3(test_free_func);
+        f3.prefetch();
+        FixedFunction<int()> f4([]() { return 1; });
+        f4.prefetch();
+        ASSERT(1 == f4());
+    });
+
 }
 
 
@@ -0,0 +1,200 @@
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A producer pushing this id dies between claiming a cell and publishing it.
+static const size_t DyingProducerId = 1000;
+#define SHM_BOUNDED_QUEUE_PUBLISH_HOOK(data) if (data.id == DyingProducerId) ::_exit(0)
+
+#include <shm_bounded_queue.hpp>
+#include <test.hpp>
+
+struct Payload {
+    size_t id;
+    char text[24];
+};
+
+typedef SharedMPMCBoundedQueue<Payload> Queue;
+
+static std::string queueName(const char *suffix) {
+    return "/thread_pool_test_" + std::to_string(::getpid()) + "_" + suffix;
+}
+
+int main() {
+    std::cout << "*** Testing SharedMPMCBoundedQueue ***" << std::endl;
+
+    doTest("two mappings", []() {
+        const std::string name = queueName("mappings");
+        Queue::unlink(name);
+
+        {
+            Queue producer(name, Queue::OpenMode::Create, 8);
+            Queue consumer(name, Queue::OpenMode::Open);
+
+            for (size_t i = 0; i < 8; ++i) {
+                ASSERT(producer.push(Payload{i, "payload"}));
+            }
+            ASSERT(!producer.push(Payload{8, "overflow"}));
+            ASSERT(8 == consumer.size());
+
+            Payload payload;
+            for (size_t i = 0; i < 8; ++i) {
+                ASSERT(consumer.pop(payload));
+                ASSERT(i == payload.id);
+                ASSERT(std::string("payload") == payload.text);
+            }
+            ASSERT(!consumer.pop(payload));
+
+            pid_t pid;
+            ASSERT(!consumer.deadProducer(pid));
+            ASSERT(!consumer.skipDeadProducer());
+        }
+
+        ASSERT(Queue::unlink(name));
+    });
+
+    doTest("open or create", []() {
+        const std::string name = queueName("open_or_create");
+        Queue::unlink(name);
+
+        Queue first(name, Queue::OpenMode::OpenOrCreate, 4);
+        Queue second(name, Queue::OpenMode::OpenOrCreate, 4);
+        ASSERT(first.push(Payload{1, "x"}));
+
+        Payload payload;
+        ASSERT(second.pop(payload));
+        ASSERT(1 == payload.id);
+
+        try {
+            Queue third(name, Queue::OpenMode::Create, 4);
+            ASSERT(!"exception expected");
+        } catch (const std::system_error &) {
+        }
+
+        Queue::unlink(name);
+    });
+
+    doTest("open missing segment", []() {
+        try {
+            Queue queue(queueName("missing"), Queue::OpenMode::Open, 0, std::chrono::milliseconds(10));
+            ASSERT(!"exception expected");
+        } catch (const std::runtime_error &) {
+        }
+    });
+
+    doTest("layout mismatch", []() {
+        const std::string name = queueName("layout");
+        Queue::unlink(name);
+
+        SharedMPMCBoundedQueue<size_t> queue(name, SharedMPMCBoundedQueue<size_t>::OpenMode::Create, 4);
+        try {
+            Queue other(name, Queue::OpenMode::Open);
+            ASSERT(!"exception expected");
+        } catch (const std::runtime_error &) {
+        }
+
+        Queue::unlink(name);
+    });
+
+    doTest("dead creator", []() {
+        const std::string name = queueName("dead_creator");
+        Queue::unlink(name);
+
+        pid_t child = ::fork();
+        if (child == 0) {
+            ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            ::_exit(0);
+        }
+        int status = 0;
+        ::waitpid(child, &status, 0);
+
+        try {
+            Queue waiting(name, Queue::OpenMode::Open, 0, std::chrono::milliseconds(10));
+            ASSERT(!"exception expected");
+        } catch (const std::runtime_error &) {
+        }
+
+        Queue queue(name, Queue::OpenMode::OpenOrCreate, 4, std::chrono::milliseconds(100));
+        ASSERT(queue.push(Payload{1, "taken over"}));
+
+        Queue consumer(name, Queue::OpenMode::Open);
+        Payload payload;
+        ASSERT(consumer.pop(payload));
+        ASSERT(1 == payload.id);
+
+        Queue::unlink(name);
+    });
+
+    doTest("dead producer", []() {
+        const std::string name = queueName("dead_producer");
+        Queue::unlink(name);
+
+        Queue consumer(name, Queue::OpenMode::Create, 8);
+
+        pid_t child = ::fork();
+        if (child == 0) {
+            Queue producer(name, Queue::OpenMode::Open);
+            producer.push(Payload{0, "child"});
+            producer.push(Payload{DyingProducerId, "dying"});
+            ::_exit(1);
+        }
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        ASSERT(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+        ASSERT(consumer.push(Payload{1, "parent"}));
+        ASSERT(consumer.push(Payload{2, "parent"}));
+
+        Payload payload;
+        ASSERT(consumer.pop(payload));
+        ASSERT(0 == payload.id);
+        ASSERT(!consumer.pop(payload));
+        ASSERT(3 == consumer.size());
+
+        pid_t pid = 0;
+        ASSERT(consumer.deadProducer(pid));
+        ASSERT(child == pid);
+        ASSERT(consumer.skipDeadProducer());
+        ASSERT(!consumer.deadProducer(pid));
+
+        ASSERT(consumer.pop(payload));
+        ASSERT(1 == payload.id);
+        ASSERT(consumer.pop(payload));
+        ASSERT(2 == payload.id);
+        ASSERT(!consumer.pop(payload));
+
+        Queue::unlink(name);
+    });
+
+    doTest("producer process", []() {
+        const std::string name = queueName("process");
+        Queue::unlink(name);
+
+        Queue consumer(name, Queue::OpenMode::Create, 64);
+
+        pid_t child = ::fork();
+        if (child == 0) {
+            Queue producer(name, Queue::OpenMode::Open);
+            for (size_t i = 0; i < 100; ++i) {
+                while (!producer.push(Payload{i, "child"})) {
+                    std::this_thread::yield();
+                }
+            }
+            ::_exit(0);
+        }
+
+        Payload payload;
+        for (size_t i = 0; i < 100; ++i) {
+            while (!consumer.pop(payload)) {
+                std::this_thread::yield();
+            }
+            ASSERT(i == payload.id);
+        }
+
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        ASSERT(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+        Queue::unlink(name);
+    });
+}
@@ -1,10 +1,23 @@
 #include <thread_pool.hpp>
+#include <submission_buffer.hpp>
+#include <ordered_map.hpp>
+#include <parallel_for.hpp>
+#include <pool_algorithms.hpp>
+#include <hash_aggregate.hpp>
+#include <parallel_memory.hpp>
+#include <pool_simulator.hpp>
+#include <multi_queue.hpp>
 #include <test.hpp>
 
 #include <thread>
 #include <future>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 
 int main() {
     std::cout << "*** Testing ThreadPool ***" << std::endl;
@@ -102,4 +115,1146 @@ int main() {
         
         ASSERT(0 == startCount);
     });
+
+    doTest("submission buffer", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 2;
+        ThreadPool pool{options};
+
+        std::atomic<size_t> executed{0};
+        {
+            SubmissionBuffer buffer(pool, 8, std::chrono::microseconds(0));
+
+            for (size_t i = 0; i < 7; ++i) {
+                buffer.post([&executed](size_t) { ++executed; });
+            }
+            ASSERT(7 == buffer.size());
+
+            buffer.post([&executed](size_t) { ++executed; });
+            ASSERT(0 == buffer.size());
+
+            for (size_t i = 0; i < 12; ++i) {
+                buffer.post([&executed](size_t) { ++executed; });
+            }
+            ASSERT(4 == buffer.size());
+            buffer.flush();
+            ASSERT(0 == buffer.size());
+
+            buffer.post([&executed](size_t) { ++executed; });
+        }
+
+        while (executed < 21) {
+            std::this_thread::yield();
+        }
+
+        SubmissionBuffer timed(pool, 64, std::chrono::microseconds(100), true);
+        timed.post([&executed](size_t) { ++executed; });
+        while (executed < 22) {
+            std::this_thread::yield();
+        }
+        ASSERT(0 == timed.size());
+
+        SubmissionBuffer fast(pool, 64, std::chrono::microseconds(1), true);
+        fast.post([&executed](WorkerContext &) { ++executed; });
+        while (executed < 23) {
+            std::this_thread::yield();
+        }
+    });
+
+    doTest("ordered map", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 4;
+        ThreadPool pool{options};
+
+        int next = 0;
+        std::vector<std::string> results;
+        orderedMap<int>(pool,
+            [&next](int &item) { item = next++; return item < 1000; },
+            [](int &&item) {
+                if (item % 7 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                return std::to_string(item * 2);
+            },
+            [&results](std::string &&result) { results.push_back(std::move(result)); },
+            16);
+
+        ASSERT(1000 == results.size());
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT(std::to_string(i * 2) == results[i]);
+        }
+    });
+
+    doTest("ordered map with exception", []() {
+        ThreadPool pool;
+
+        int next = 0;
+        int emitted = 0;
+        try {
+            orderedMap<int>(pool,
+                [&next](int &item) { item = next++; return item < 100; },
+                [](int &&item) {
+                    if (item == 42) {
+                        throw my_exception();
+                    }
+                    return item;
+                },
+                [&emitted](int &&result) { ASSERT(emitted++ == result); },
+                8);
+            ASSERT(!"exception expected");
+        } catch (const my_exception &) {
+        }
+
+        ASSERT(42 == emitted);
+    });
+
+    doTest("balancing strategies", []() {
+        for (auto strategy : {BalancingStrategy::Hybrid, BalancingStrategy::WorkStealing, BalancingStrategy::WorkSharing}) {
+            ThreadPoolOptions options;
+            options.threads_count = 4;
+            options.balancing = strategy;
+            ThreadPool pool{options};
+
+            std::atomic<size_t> executed{0};
+            std::function<void(size_t)> spawn = [&](size_t depth) {
+                ++executed;
+                if (depth < 8) {
+                    pool.post([&spawn, depth](size_t) { spawn(depth + 1); });
+                    pool.post([&spawn, depth](size_t) { spawn(depth + 1); });
+                }
+            };
+            pool.post([&spawn](size_t) { spawn(0); });
+
+            while (executed < (1u << 9) - 1) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    doTest("resident memory", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 2;
+        options.worker_queue_size = 1 << 14;
+        ThreadPool pool{options};
+
+        size_t reserved = options.threads_count * options.worker_queue_size * sizeof(Worker::Task);
+        size_t initial = pool.getResidentMemory();
+        ASSERT(initial < reserved / 100);
+
+        std::atomic<size_t> executed{0};
+        for (size_t i = 0; i < 4000; ++i) {
+            pool.post([&executed](size_t) { ++executed; });
+        }
+        while (executed < 4000) {
+            std::this_thread::yield();
+        }
+
+        size_t used = pool.getResidentMemory();
+        ASSERT(used > initial);
+        ASSERT(used < reserved / 2);
+    });
+
+    doTest("queue destroys items", []() {
+        auto resource = std::make_shared<int>(42);
+        {
+            MPMCBoundedQueue<std::shared_ptr<int>> queue(4);
+            ASSERT(queue.push(resource));
+            ASSERT(queue.push(resource));
+
+            std::shared_ptr<int> item;
+            ASSERT(queue.pop(item));
+            ASSERT(3 == resource.use_count());
+        }
+        ASSERT(1 == resource.use_count());
+    });
+
+    doTest("task log", []() {
+        const std::string path = "thread_pool_test.log";
+        std::remove(path.c_str());
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 2;
+            options.log_path = path;
+            ThreadPool pool{options};
+
+            ASSERT(!ThreadPool::log("not a worker"));
+
+            auto r = pool.process([](size_t) {
+                return ThreadPool::log("task {} of {}: {} {}", 1, 2u, 0.5, "done");
+            });
+            ASSERT(r.get());
+        }
+
+        std::ifstream file(path);
+        std::string line;
+        ASSERT(std::getline(file, line));
+        ASSERT(line.find("task 1 of 2: 0.5 done") != std::string::npos);
+        std::remove(path.c_str());
+    });
+
+    doTest("worker context", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        ThreadPool pool{options};
+
+        auto r = pool.process([](WorkerContext &context) {
+            static int arena = 0;
+            context.userData() = &arena;
+            return context.getId() + (context.random() != context.random() ? 10 : 0);
+        });
+        ASSERT(10 == r.get());
+
+        std::promise<size_t> local;
+        pool.post([&local](WorkerContext &context) {
+            ASSERT(context.userData() != nullptr);
+            size_t before = context.getTaskCount();
+            context.post([&local, before](WorkerContext &context) {
+                local.set_value(context.getTaskCount() - before);
+            });
+        });
+        ASSERT(1 == local.get_future().get());
+
+        auto id = pool.process([](size_t id) { return id; });
+        ASSERT(0 == id.get());
+    });
+
+    doTest("qsbr", []() {
+        static std::atomic<int> alive{0};
+        struct Config {
+            int version;
+            explicit Config(int version) : version(version) { ++alive; }
+            ~Config() { --alive; }
+        };
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 2;
+            options.qsbr = true;
+            ThreadPool pool{options};
+
+            QsbrPtr<Config> config(pool.getQsbr(), new Config(0));
+
+            std::atomic<int> last_seen{0};
+            std::atomic<size_t> executed{0};
+            for (int version = 1; version <= 100; ++version) {
+                pool.post([&](size_t) {
+                    Config *current = config.load();
+                    ASSERT(current->version >= 0);
+                    last_seen = current->version;
+                    ++executed;
+                });
+                config.publish(new Config(version));
+            }
+
+            while (executed < 100) {
+                std::this_thread::yield();
+            }
+
+            pool.getQsbr().synchronize();
+            ASSERT(0 == pool.getQsbr().getRetiredCount());
+            ASSERT(1 == alive);
+        }
+
+        ASSERT(0 == alive);
+
+        ThreadPoolOptions plain_options;
+        plain_options.threads_count = 1;
+        ThreadPool plain{plain_options};
+        bool thrown = false;
+        try {
+            plain.getQsbr();
+        } catch (const std::logic_error &) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    });
+
+    doTest("slab allocator", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 2;
+        options.slab_allocator = true;
+        ThreadPool pool{options};
+
+        auto first = pool.process([](size_t) {
+            std::vector<void *> blocks;
+            for (size_t size : {1, 16, 17, 100, 2048, 4096}) {
+                void *block = SlabAllocator::allocate(size);
+                ASSERT(0 == reinterpret_cast<uintptr_t>(block) % 16);
+                std::memset(block, 0xab, size);
+                blocks.push_back(block);
+            }
+            return blocks;
+        }).get();
+
+        std::atomic<size_t> freed{0};
+        for (void *block : first) {
+            pool.post([block, &freed](size_t) {
+                SlabAllocator::deallocate(block);
+                ++freed;
+            });
+        }
+        while (freed < first.size()) {
+            std::this_thread::yield();
+        }
+
+        auto reused = pool.process([](size_t) {
+            int *value = SlabAllocator::create<int>(42);
+            int result = *value;
+            SlabAllocator::destroy(value);
+            return result;
+        });
+        ASSERT(42 == reused.get());
+
+        void *outside = SlabAllocator::allocate(64);
+        SlabAllocator::deallocate(outside);
+
+        ThreadPoolOptions plain_options;
+        plain_options.threads_count = 1;
+        ThreadPool plain{plain_options};
+        auto heap = plain.process([](size_t) {
+            int *value = SlabAllocator::create<int>(7);
+            int result = *value;
+            SlabAllocator::destroy(value);
+            return result;
+        });
+        ASSERT(7 == heap.get());
+
+        bool thrown = false;
+        try {
+            plain.getSlabAllocator();
+        } catch (const std::logic_error &) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    });
+
+    doTest("trace recorder", []() {
+        const std::string path = "thread_pool_test.trace";
+        std::remove(path.c_str());
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 2;
+            options.trace_path = path;
+            ThreadPool pool{options};
+
+            std::atomic<size_t> done{0};
+            pool.post([&done](size_t) { ++done; }, 7);
+            pool.post([&done](size_t) { ++done; }, 7);
+
+            char big[112] = {};
+            pool.post([&done, big](size_t) { done += big[0] + 1; }, 9);
+
+            ASSERT(42 == pool.process([](size_t) { return 42; }).get());
+
+            pool.postIdle([&done](size_t) { ++done; });
+
+            Worker::Task bulk[2] = {[&done](size_t) { ++done; }, [&done](size_t) { ++done; }};
+            ASSERT(2 == pool.postBulk(bulk, 2));
+
+            struct Counted : IntrusiveTask {
+                std::atomic<size_t> *done;
+                void run(WorkerContext &) override { ++*done; }
+            } intrusive;
+            intrusive.done = &done;
+            pool.postIntrusive(intrusive);
+
+            while (done < 7) {
+                std::this_thread::yield();
+            }
+        }
+
+        auto records = TraceRecorder::load(path);
+        ASSERT(8 == records.size());
+
+        size_t measured = 0;
+        size_t tagged = 0;
+        for (const auto &record : records) {
+            if (record.tag == 7) {
+                ++tagged;
+                ASSERT(record.duration != TraceRecord::Unmeasured);
+            }
+            if (record.tag == 9) {
+                ASSERT(record.duration == TraceRecord::Unmeasured);
+                ASSERT(7 == record.size_class);
+            }
+            measured += record.duration != TraceRecord::Unmeasured;
+        }
+        ASSERT(2 == tagged);
+        ASSERT(4 == measured);
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 1;
+            options.worker_queue_size = 2;
+            options.trace_path = path;
+            ThreadPool pool{options};
+
+            std::promise<void> started;
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+            pool.post([&started, released](size_t) {
+                started.set_value();
+                released.wait();
+            });
+            started.get_future().wait();
+            std::atomic<int> queued{0};
+            pool.post([&queued](size_t) { ++queued; });
+            pool.post([&queued](size_t) { ++queued; });
+
+            auto payload = std::make_shared<int>(42);
+            auto rejected = [payload](size_t) {};
+            bool thrown = false;
+            try {
+                pool.post(std::move(rejected));
+            } catch (const std::overflow_error &) {
+                thrown = true;
+            }
+            ASSERT(thrown);
+            ASSERT(2 == payload.use_count());
+            release.set_value();
+            while (queued < 2) {
+                std::this_thread::yield();
+            }
+        }
+
+        ASSERT(3 == TraceRecorder::load(path).size());
+        std::remove(path.c_str());
+    });
+
+    doTest("pool simulator", []() {
+        std::vector<SimulatedTask> workload(1000);
+        for (size_t i = 0; i < workload.size(); ++i) {
+            workload[i].arrival = i * 100;
+            workload[i].duration = i % 10 == 0 ? 100000 : 1000;
+        }
+        SimulatedTask tree;
+        tree.duration = 500;
+        tree.fanout = 2;
+        tree.depth = 6;
+        workload.push_back(tree);
+
+        SimulatorOptions options;
+        options.workers_count = 4;
+
+        PoolSimulator simulator(options);
+        SimulatorReport first = simulator.run(workload);
+        SimulatorReport second = simulator.run(workload);
+        ASSERT(first.makespan == second.makespan);
+        ASSERT(first.steals == second.steals);
+        ASSERT(first.start_p99 == second.start_p99);
+        ASSERT(first.executed_per_worker == second.executed_per_worker);
+
+        ASSERT(1000 + 127 == first.executed);
+        ASSERT(0 == first.rejected);
+        ASSERT(first.utilization > 0 && first.utilization <= 1);
+        ASSERT(first.start_p50 <= first.start_p99 && first.start_p99 <= first.start_max);
+
+        options.balancing = BalancingStrategy::WorkSharing;
+        SimulatorReport sharing = PoolSimulator(options).run(workload);
+        ASSERT(0 == sharing.steals);
+        ASSERT(1000 + 127 == sharing.executed);
+
+        options.worker_queue_size = 2;
+        SimulatorReport overflow = PoolSimulator(options).run(workload);
+        ASSERT(overflow.rejected > 0);
+        ASSERT(overflow.executed + overflow.rejected <= 1000 + 127);
+    });
+
+    doTest("parallel for", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 3;
+        ThreadPool pool{options};
+
+        std::vector<std::atomic<int>> visited(10007);
+        parallelFor(pool, 0, visited.size(), [&visited](size_t i) { ++visited[i]; });
+        for (auto &count : visited) {
+            ASSERT(1 == count);
+        }
+
+        parallelFor(pool, 5, 5, [](size_t) { throw my_exception(); });
+
+        bool thrown = false;
+        try {
+            parallelFor(pool, 0, 1000, [](size_t i) {
+                if (i == 500) {
+                    throw my_exception();
+                }
+            });
+        } catch (const my_exception &) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+
+        auto nested = pool.process([&pool](size_t) {
+            std::atomic<size_t> sum{0};
+            parallelFor(pool, 0, 100, [&sum](size_t i) { sum += i; }, 7);
+            return sum.load();
+        });
+        ASSERT(4950 == nested.get());
+    });
+
+    doTest("parallel for tiles", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 3;
+        ThreadPool pool{options};
+
+        for (auto order : {TileOrder::RowMajor, TileOrder::Morton, TileOrder::Hilbert}) {
+            const size_t width = 100;
+            const size_t height = 37;
+            std::vector<std::atomic<int>> visited(width * height);
+            parallelFor2d(pool, width, height, TileShape{16, 8, 1},
+                          [&](size_t x_begin, size_t x_end, size_t y_begin, size_t y_end) {
+                for (size_t y = y_begin; y < y_end; ++y) {
+                    for (size_t x = x_begin; x < x_end; ++x) {
+                        ++visited[y * width + x];
+                    }
+                }
+            }, order);
+            for (auto &count : visited) {
+                ASSERT(1 == count);
+            }
+
+            std::vector<std::atomic<int>> cells(9 * 10 * 11);
+            parallelFor3d(pool, 9, 10, 11, TileShape{4, 4, 4},
+                          [&](size_t x0, size_t x1, size_t y0, size_t y1, size_t z0, size_t z1) {
+                for (size_t z = z0; z < z1; ++z) {
+                    for (size_t y = y0; y < y1; ++y) {
+                        for (size_t x = x0; x < x1; ++x) {
+                            ++cells[(z * 10 + y) * 9 + x];
+                        }
+                    }
+                }
+            }, order);
+            for (auto &count : cells) {
+                ASSERT(1 == count);
+            }
+        }
+
+        auto distance = [](size_t a, size_t b, size_t side) {
+            auto diff = [](size_t x, size_t y) { return x > y ? x - y : y - x; };
+            return diff(a % side, b % side) + diff(a / side % side, b / side % side) + diff(a / side / side, b / side / side);
+        };
+
+        const size_t square[3] = {8, 8, 1};
+        auto hilbert = ParallelFor::tileOrder(square, TileOrder::Hilbert);
+        ASSERT(64 == hilbert.size());
+        for (size_t i = 1; i < hilbert.size(); ++i) {
+            ASSERT(1 == distance(hilbert[i - 1], hilbert[i], 8));
+        }
+
+        const size_t cube[3] = {4, 4, 4};
+        auto hilbert3d = ParallelFor::tileOrder(cube, TileOrder::Hilbert);
+        for (size_t i = 1; i < hilbert3d.size(); ++i) {
+            ASSERT(1 == distance(hilbert3d[i - 1], hilbert3d[i], 4));
+        }
+
+        auto morton = ParallelFor::tileOrder(square, TileOrder::Morton);
+        ASSERT(0 == morton[0] && 1 == morton[1] && 8 == morton[2] && 9 == morton[3]);
+    });
+
+    doTest("pool algorithms", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 3;
+        ThreadPool pool{options};
+        PoolExecutionPolicy policy(pool);
+
+        std::vector<int> values(10000);
+        fill(policy, values.begin(), values.end(), 1);
+        ASSERT(10000 == reduce(policy, values.begin(), values.end(), 0));
+
+        forEach(policy.withGrain(3), values.begin(), values.end(), [](int &value) { value *= 2; });
+        std::vector<long> doubled(values.size());
+        auto end = transform(policy, values.begin(), values.end(), doubled.begin(), [](int value) {
+            return value * 2L;
+        });
+        ASSERT(end == doubled.end());
+        ASSERT(4 == doubled.front() && 4 == doubled.back());
+
+        std::vector<long> sums(values.size());
+        transform(policy, values.begin(), values.end(), doubled.begin(), sums.begin(), [](int a, long b) {
+            return a + b;
+        });
+        ASSERT(60000 == reduce(policy, sums.begin(), sums.end(), 0L));
+
+        std::vector<std::string> words = {"a", "b", "c", "d", "e", "f", "g"};
+        auto joined = reduce(policy.withGrain(2), words.begin(), words.end(), std::string(">"),
+                             [](const std::string &a, const std::string &b) { return a + b; });
+        ASSERT(">abcdefg" == joined);
+
+        auto squares = transformReduce(policy, values.begin(), values.end(), 0L,
+                                       [](long a, long b) { return a + b; },
+                                       [](int value) { return long(value) * value; });
+        ASSERT(40000 == squares);
+
+        values[17] = 5;
+        ASSERT(1 == countIf(policy, values.begin(), values.end(), [](int value) { return value == 5; }));
+        ASSERT(0 == reduce(policy, values.begin(), values.begin(), 0));
+    });
+
+    doTest("urgent workers", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        options.urgent_threads_count = 1;
+        options.urgent_nice = -1;
+        ThreadPool pool{options};
+        ASSERT(1 == pool.getWorkerCount());
+        ASSERT(1 == pool.getUrgentWorkerCount());
+
+        std::atomic<bool> release{false};
+        pool.post([&release](size_t) {
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+
+        std::atomic<size_t> urgent_id{0};
+        pool.postUrgent([&urgent_id](WorkerContext &context) { urgent_id = context.getId() + 1; });
+        while (urgent_id == 0) {
+            std::this_thread::yield();
+        }
+        ASSERT(2 == urgent_id);
+
+        release = true;
+        auto ordinary = pool.process([](size_t id) { return id; });
+        ASSERT(0 == ordinary.get());
+    });
+
+    doTest("warm up", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 2;
+        options.urgent_threads_count = 1;
+        options.warm_up = true;
+        options.worker_queue_size = 4096;
+        ThreadPool pool{options};
+
+        ThreadPoolOptions lazy_options = options;
+        lazy_options.warm_up = false;
+        ThreadPool lazy_pool{lazy_options};
+        ASSERT(pool.getResidentMemory() > lazy_pool.getResidentMemory());
+
+        ASSERT(42 == pool.process([](size_t) { return 42; }).get());
+
+        ThreadPoolOptions deep_options;
+        deep_options.threads_count = 1;
+        deep_options.warm_up = true;
+        deep_options.warm_up_stack_size = size_t(1) << 30;
+        ThreadPool deep_pool{deep_options};
+        ASSERT(42 == deep_pool.process([](size_t) { return 42; }).get());
+    });
+
+    doTest("preemption", []() {
+        auto longTask = [](std::atomic<bool> &started, std::atomic<bool> &yielded) {
+            return [&started, &yielded](WorkerContext &context) {
+                started = true;
+                while (!context.preemptRequested()) {
+                    std::this_thread::yield();
+                }
+                yielded = true;
+            };
+        };
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 1;
+            options.preempt_queue_threshold = 2;
+            ThreadPool pool{options};
+
+            std::atomic<bool> started{false};
+            std::atomic<bool> yielded{false};
+            pool.post(longTask(started, yielded));
+            while (!started) {
+                std::this_thread::yield();
+            }
+            pool.post([](size_t) {});
+            ASSERT(!yielded);
+            pool.post([](size_t) {});
+            while (!yielded) {
+                std::this_thread::yield();
+            }
+        }
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 1;
+            options.preempt_queue_threshold = 2;
+            ThreadPool pool{options};
+
+            std::atomic<bool> started{false};
+            std::atomic<bool> yielded{false};
+            pool.post(longTask(started, yielded));
+            while (!started) {
+                std::this_thread::yield();
+            }
+            Worker::Task bulk[2] = {[](size_t) {}, [](size_t) {}};
+            ASSERT(2 == pool.postBulk(bulk, 2));
+            while (!yielded) {
+                std::this_thread::yield();
+            }
+        }
+
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 1;
+            options.preempt_time_slice = std::chrono::milliseconds(2);
+            ThreadPool pool{options};
+
+            std::atomic<bool> started{false};
+            std::atomic<bool> yielded{false};
+            pool.post(longTask(started, yielded));
+            while (!yielded) {
+                std::this_thread::yield();
+            }
+        }
+
+        std::atomic<bool> started{false};
+        std::atomic<bool> yielded{false};
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 1;
+            ThreadPool pool{options};
+            pool.post(longTask(started, yielded));
+            while (!started) {
+                std::this_thread::yield();
+            }
+        }
+        ASSERT(yielded);
+
+        // Tasks starting while other workers are joined still see the shutdown,
+        // and the tasks queued behind the running ones are dropped.
+        std::atomic<int> running{0};
+        std::atomic<int> finished{0};
+        {
+            ThreadPoolOptions options;
+            options.threads_count = 2;
+            ThreadPool pool{options};
+            for (int i = 0; i < 8; ++i) {
+                pool.post([&running, &finished](WorkerContext &context) {
+                    ++running;
+                    while (!context.preemptRequested()) {
+                        std::this_thread::yield();
+                    }
+                    ++finished;
+                });
+            }
+            while (running < 2) {
+                std::this_thread::yield();
+            }
+        }
+        ASSERT(2 == finished);
+    });
+
+    doTest("hash aggregate", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 3;
+        ThreadPool pool{options};
+
+        struct Row {
+            uint32_t customer;
+            uint32_t amount;
+        };
+
+        std::vector<Row> rows(100000);
+        for (size_t i = 0; i < rows.size(); ++i) {
+            rows[i] = Row{static_cast<uint32_t>(i * 7919 % 1000), static_cast<uint32_t>(i % 10)};
+        }
+
+        auto totals = hashAggregate(pool, rows.begin(), rows.end(),
+                                    [](const Row &row) { return row.customer; },
+                                    std::make_pair(size_t(0), size_t(0)),
+                                    [](std::pair<size_t, size_t> &total, const Row &row) {
+                                        total.first += row.amount;
+                                        ++total.second;
+                                    });
+        ASSERT(1000 == totals.size());
+
+        std::vector<size_t> expected(1000, 0);
+        for (const auto &row : rows) {
+            expected[row.customer] += row.amount;
+        }
+        std::vector<bool> seen(1000, false);
+        for (const auto &group : totals) {
+            ASSERT(!seen[group.first]);
+            seen[group.first] = true;
+            ASSERT(expected[group.first] == group.second.first);
+            ASSERT(100 == group.second.second);
+        }
+
+        std::vector<std::string> words = {"a", "bb", "a", "ccc", "bb", "a"};
+        HashAggregate<std::string, int> counter(pool, 4096);
+        auto counts = counter.run(words.begin(), words.end(), [](const std::string &word) { return word; },
+                                  0, [](int &count, const std::string &) { ++count; });
+        ASSERT(3 == counts.size());
+        for (const auto &group : counts) {
+            ASSERT(group.second == (group.first == "a" ? 3 : group.first == "bb" ? 2 : 1));
+        }
+
+        ASSERT(hashAggregate(pool, words.begin(), words.begin(), [](const std::string &word) { return word; },
+                             0, [](int &, const std::string &) {}).empty());
+    });
+
+    doTest("parallel memory", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 3;
+        ThreadPool pool{options};
+
+        for (size_t size : {size_t(1000), size_t(3 << 20) + 13, ParallelMemory::StreamThreshold + 4097}) {
+            std::vector<char> src(size + 16);
+            for (size_t i = 0; i < src.size(); ++i) {
+                src[i] = static_cast<char>(i * 31 + 7);
+            }
+            std::vector<char> dst(size + 16, 0);
+
+            parallelMemcpy(pool, dst.data() + 3, src.data() + 5, size);
+            ASSERT(0 == std::memcmp(dst.data() + 3, src.data() + 5, size));
+            ASSERT(0 == dst[2] && 0 == dst[size + 3]);
+            ASSERT(0 == parallelMemcmp(pool, dst.data() + 3, src.data() + 5, size));
+
+            dst[3 + size - 1] ^= 1;
+            dst[3 + size / 2] += 1;
+            ASSERT(parallelMemcmp(pool, dst.data() + 3, src.data() + 5, size) > 0);
+            ASSERT(parallelMemcmp(pool, src.data() + 5, dst.data() + 3, size) < 0);
+
+            parallelMemset(pool, dst.data() + 1, 0x5a, size);
+            ASSERT(0 == dst[0] && 0x5a == dst[1] && 0x5a == dst[size] && 0x5a != dst[size + 1]);
+            ASSERT(size == static_cast<size_t>(std::count(dst.begin(), dst.end(), 0x5a)));
+        }
+    });
+
+    doTest("idle tasks", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        ThreadPool pool{options};
+
+        std::atomic<bool> release{false};
+        std::atomic<int> order{0};
+        std::atomic<int> regular_order{0};
+        std::atomic<int> idle_order{0};
+        pool.post([&release](size_t) {
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        pool.postIdle([&](size_t) { idle_order = ++order; });
+        pool.post([&](size_t) { regular_order = ++order; });
+        release = true;
+        while (idle_order == 0) {
+            std::this_thread::yield();
+        }
+        ASSERT(1 == regular_order);
+        ASSERT(2 == idle_order);
+
+        std::atomic<bool> started{false};
+        std::atomic<bool> yielded{false};
+        pool.postIdle([&](WorkerContext &context) {
+            started = true;
+            while (!context.preemptRequested()) {
+                std::this_thread::yield();
+            }
+            yielded = true;
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+        ASSERT(!yielded);
+        pool.post([](size_t) {});
+        while (!yielded) {
+            std::this_thread::yield();
+        }
+    });
+
+    doTest("deferred destruction", []() {
+        struct Heavy {
+            std::atomic<int> *destroyed;
+            std::thread::id *destroyer;
+            Heavy(std::atomic<int> *d, std::thread::id *t) : destroyed(d), destroyer(t) {}
+            Heavy(Heavy &&other) : destroyed(other.destroyed), destroyer(other.destroyer) {
+                other.destroyed = nullptr;
+            }
+            ~Heavy() {
+                if (destroyed) {
+                    *destroyer = std::this_thread::get_id();
+                    ++*destroyed;
+                }
+            }
+        };
+
+        std::atomic<int> destroyed{0};
+        std::thread::id destroyer;
+        {
+            auto heavy = makeDeferred<Heavy>(&destroyed, &destroyer);
+        }
+        ASSERT(1 == destroyed);
+        ASSERT(std::this_thread::get_id() == destroyer);
+
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        ThreadPool pool{options};
+
+        std::thread::id worker_thread;
+        std::atomic<int> finished{0};
+        std::atomic<bool> release{false};
+        pool.post([&](size_t) {
+            worker_thread = std::this_thread::get_id();
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        for (int i = 0; i < 8; ++i) {
+            auto heavy = makeDeferred<Heavy>(&destroyed, &destroyer);
+            pool.post([heavy = std::move(heavy), &finished](size_t) { ++finished; });
+        }
+        pool.post([&](size_t) {
+            // The captures of the tasks above wait for the idle step.
+            ASSERT(1 == destroyed);
+            ++finished;
+        });
+        release = true;
+        while (destroyed != 9) {
+            std::this_thread::yield();
+        }
+        ASSERT(9 == finished);
+        ASSERT(worker_thread == destroyer);
+    });
+
+    doTest("graveyard limits", []() {
+        static int destroyed;
+        destroyed = 0;
+        auto deleter = [](void *) { ++destroyed; };
+
+        Graveyard graveyard;
+        for (size_t i = 0; i < Graveyard::Limit / 2; ++i) {
+            graveyard.bury(nullptr, deleter, 1);
+        }
+        ASSERT(!graveyard.overloaded());
+        graveyard.bury(nullptr, deleter, 1);
+        ASSERT(graveyard.overloaded());
+
+        for (size_t i = graveyard.size(); i < Graveyard::Limit; ++i) {
+            graveyard.bury(nullptr, deleter, 1);
+        }
+        ASSERT(0 == destroyed);
+        graveyard.bury(nullptr, deleter, 1);
+        ASSERT(1 == destroyed);
+        ASSERT(Graveyard::Limit == graveyard.size());
+
+        ASSERT(Graveyard::Limit == graveyard.drain(Graveyard::Limit));
+        ASSERT(0 == graveyard.getBytes());
+        ASSERT(!graveyard.overloaded());
+
+        graveyard.bury(nullptr, deleter, Graveyard::ByteLimit + 1);
+        ASSERT(graveyard.overloaded());
+        ASSERT(1 == graveyard.drain(Graveyard::BatchSize));
+        ASSERT(Graveyard::Limit + 2 == size_t(destroyed));
+    });
+
+    doTest("prefetch lookahead", []() {
+        struct Step {
+            std::atomic<int> *clock;
+            std::atomic<int> *prefetched_at;
+            std::atomic<int> *run_at;
+            void prefetch() { *prefetched_at = ++*clock; }
+            void operator()(size_t) { *run_at = ++*clock; }
+        };
+
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        options.prefetch_lookahead = true;
+        ThreadPool pool{options};
+
+        std::atomic<bool> started{false};
+        std::atomic<bool> release{false};
+        pool.post([&](size_t) {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+
+        std::atomic<int> clock{0};
+        std::atomic<int> prefetched[2] = {{0}, {0}};
+        std::atomic<int> run[2] = {{0}, {0}};
+        pool.post(Step{&clock, &prefetched[0], &run[0]});
+        pool.post(Step{&clock, &prefetched[1], &run[1]});
+        release = true;
+        while (run[1] == 0) {
+            std::this_thread::yield();
+        }
+
+        ASSERT(0 == prefetched[0]);
+        ASSERT(prefetched[1] != 0);
+        ASSERT(prefetched[1] < run[0]);
+        ASSERT(run[0] < run[1]);
+
+        struct IntrusiveStep : IntrusiveTask {
+            std::atomic<int> *clock;
+            std::atomic<int> prefetched_at{0};
+            std::atomic<int> run_at{0};
+            void prefetch() override { prefetched_at = ++*clock; }
+            void run(WorkerContext &) override { run_at = ++*clock; }
+        };
+
+        started = false;
+        release = false;
+        pool.post([&](size_t) {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+
+        clock = 0;
+        IntrusiveStep steps[2];
+        for (auto &step : steps) {
+            step.clock = &clock;
+            pool.postIntrusive(step);
+        }
+        release = true;
+        while (steps[1].run_at == 0) {
+            std::this_thread::yield();
+        }
+
+        ASSERT(0 == steps[0].prefetched_at);
+        ASSERT(steps[1].prefetched_at != 0);
+        ASSERT(steps[1].prefetched_at < steps[0].run_at);
+        ASSERT(steps[0].run_at < steps[1].run_at);
+    });
+
+    doTest("multi queue", []() {
+        MultiQueue<int> ordered(1, 4);
+        for (int priority : {3, 1, 4, 2}) {
+            ASSERT(ordered.push(priority, priority * 10));
+        }
+        ASSERT(!ordered.push(0, 0));
+        for (int expected = 1; expected <= 4; ++expected) {
+            int value = 0;
+            ASSERT(ordered.pop(value));
+            ASSERT(expected * 10 == value);
+        }
+        int value = 0;
+        ASSERT(!ordered.pop(value));
+
+        const int count = 4000;
+        MultiQueue<int> relaxed(8, count);
+        std::atomic<int> pushed{0};
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 4; ++t) {
+            producers.emplace_back([&relaxed, &pushed, t]() {
+                for (int i = t; i < count; i += 4) {
+                    if (relaxed.push(uint64_t(i) * 7919 % count, i)) {
+                        ++pushed;
+                    }
+                }
+            });
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+        ASSERT(count == pushed);
+
+        std::vector<bool> seen(count, false);
+        for (int i = 0; i < count; ++i) {
+            ASSERT(relaxed.pop(value));
+            ASSERT(!seen[value]);
+            seen[value] = true;
+        }
+        ASSERT(!relaxed.pop(value));
+    });
+
+    doTest("post priority", []() {
+        ThreadPoolOptions options;
+        options.threads_count = 1;
+        options.priority_queue_size = 8;
+        options.priority_heaps_per_worker = 1;
+        ThreadPool pool{options};
+
+        std::atomic<bool> started{false};
+        std::atomic<bool> release{false};
+        pool.post([&](size_t) {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+
+        std::mutex mutex;
+        std::vector<int> order;
+        for (int priority : {50, 10, 40, 20, 30}) {
+            pool.postPriority([&mutex, &order, priority](size_t) {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(priority);
+            }, priority);
+        }
+        release = true;
+
+        while (true) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (order.size() == 5) {
+                break;
+            }
+        }
+        ASSERT((std::vector<int>{10, 20, 30, 40, 50}) == order);
+
+        ThreadPoolOptions plain_options;
+        plain_options.threads_count = 1;
+        ThreadPool plain{plain_options};
+        std::promise<void> ran;
+        plain.postPriority([&ran](size_t) { ran.set_value(); }, 7);
+        ran.get_future().wait();
+    });
+
+    doTest("post intrusive", []() {
+        struct Chain : IntrusiveTask {
+            ThreadPool *pool;
+            std::atomic<int> *runs;
+            int left;
+            char payload[1024];
+
+            void run(WorkerContext &) override {
+                std::atomic<int> *counter = runs;
+                if (--left != 0) {
+                    pool->postIntrusive(*this);
+                }
+                ++*counter;
+            }
+        };
+
+        ThreadPoolOptions options;
+        options.threads_count = 2;
+        ThreadPool pool{options};
+
+        std::atomic<int> runs{0};
+        std::vector<Chain> chains(16);
+        std::vector<std::thread> producers;
+        for (size_t t = 0; t < 2; ++t) {
+            producers.emplace_back([&pool, &runs, &chains, t]() {
+                for (size_t i = t; i < chains.size(); i += 2) {
+                    chains[i].pool = &pool;
+                    chains[i].runs = &runs;
+                    chains[i].left = 10;
+                    pool.postIntrusive(chains[i]);
+                }
+            });
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+
+        while (runs != 160) {
+            std::this_thread::yield();
+        }
+        for (const auto &chain : chains) {
+            ASSERT(0 == chain.left);
+        }
+    });
 }
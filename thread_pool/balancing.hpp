@@ -0,0 +1,127 @@
+#ifndef BALANCING_HPP
+#define BALANCING_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief The BalancingStrategy enum selects how tasks are spread among workers.
+ *  - Hybrid: tasks are distributed round-robin, idle worker steals from its neighbour.
+ *  - WorkStealing: tasks posted from a worker go to its own queue, tasks posted from
+ *    outside are distributed round-robin, idle worker steals from all other workers.
+ *  - WorkSharing: tasks go to the less loaded of two candidate workers, no stealing.
+ */
+enum class BalancingStrategy {
+    Hybrid,
+    WorkStealing,
+    WorkSharing
+};
+
+/**
+ * @brief The BalancingPolicy struct implements placement and stealing decisions.
+ * It doesn't depend on Worker so the same decisions can be evaluated against
+ * other worker models.
+ */
+struct BalancingPolicy {
+    /**
+     * @brief noWorker Value of 'local' worker id for tasks posted from outside of pool.
+     */
+    static constexpr size_t noWorker = static_cast<size_t>(-1);
+
+    /**
+     * @brief place Choose worker for a new task.
+     * @param strategy Balancing strategy.
+     * @param workers_count Number of workers.
+     * @param local Id of the posting worker or noWorker.
+     * @param ticket Callable returning sequential number of placement. Called at most once.
+     * @param load Callable returning approximate queue length of the worker with given id.
+     * @return Id of the worker.
+     */
+    template <typename Ticket, typename Load>
+    static size_t place(BalancingStrategy strategy, size_t workers_count, size_t local,
+                        Ticket &&ticket, Load &&load);
+
+    /**
+     * @brief stealDonors Ids of workers which worker 'id' tries to steal from.
+     * @param strategy Balancing strategy.
+     * @param id Id of the stealing worker.
+     * @param workers_count Number of workers.
+     * @return Donors ids starting from the nearest one.
+     */
+    static std::vector<size_t> stealDonors(BalancingStrategy strategy, size_t id, size_t workers_count);
+
+    /**
+     * @brief steal Visit donors starting from the rotating position to spread contention.
+     * @param donors_count Number of donors.
+     * @param cursor Rotating position, advanced past the successful donor.
+     * @param try_steal Callable taking donor index and returning true on success.
+     * @return true if some donor gave a task.
+     */
+    template <typename TrySteal>
+    static bool steal(size_t donors_count, size_t &cursor, TrySteal &&try_steal);
+
+    /**
+     * @brief idleSleep Time a worker sleeps when it found no task to run.
+     */
+    static std::chrono::microseconds idleSleep();
+};
+
+
+/// Implementation
+
+template <typename Ticket, typename Load>
+inline size_t BalancingPolicy::place(BalancingStrategy strategy, size_t workers_count, size_t local,
+                                     Ticket &&ticket, Load &&load) {
+    if (strategy == BalancingStrategy::WorkStealing && local < workers_count) {
+        return local;
+    }
+
+    size_t number = ticket();
+    size_t first = number % workers_count;
+    if (strategy != BalancingStrategy::WorkSharing || workers_count < 2) {
+        return first;
+    }
+
+    size_t second = (first + 1 + (number / workers_count) % (workers_count - 1)) % workers_count;
+    return load(second) < load(first) ? second : first;
+}
+
+inline std::vector<size_t> BalancingPolicy::stealDonors(BalancingStrategy strategy, size_t id,
+                                                        size_t workers_count) {
+    std::vector<size_t> donors;
+
+    switch (strategy) {
+    case BalancingStrategy::Hybrid:
+        if (workers_count > 1) {
+            donors.push_back((id + 1) % workers_count);
+        }
+        break;
+    case BalancingStrategy::WorkStealing:
+        for (size_t i = 1; i < workers_count; ++i) {
+            donors.push_back((id + i) % workers_count);
+        }
+        break;
+    case BalancingStrategy::WorkSharing:
+        break;
+    }
+
+    return donors;
+}
+
+template <typename TrySteal>
+inline bool BalancingPolicy::steal(size_t donors_count, size_t &cursor, TrySteal &&try_steal) {
+    for (size_t i = 0; i < donors_count; ++i) {
+        if (try_steal((cursor + i) % donors_count)) {
+            cursor += i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline std::chrono::microseconds BalancingPolicy::idleSleep() {
+    return std::chrono::milliseconds(1);
+}
+
+#endif
@@ -6,12 +6,34 @@
 #include <stdexcept>
 #include <utility>
 
+/**
+ * @brief prefetchObject Call 'object.prefetch()' if the object has such method.
+ * Does nothing otherwise.
+ */
+template <typename T>
+inline auto prefetchObject(T &object, int) -> decltype(object.prefetch(), void())
+{
+    object.prefetch();
+}
+
+template <typename T>
+inline void prefetchObject(T &, long)
+{
+}
+
+template <typename T>
+inline void prefetchObject(T &object)
+{
+    prefetchObject(object, 0);
+}
+
 /**
  * @brief The FixedFunction<R(ARGS...), STORAGE_SIZE> class implements functional object.
  * This function is analog of 'std::function' with limited capabilities:
  *  - It supports only move semantics.
  *  - The size of functional objects is limited to storage size.
  * Due to limitations above it is much faster on creation and copying than std::function.
+ * If the stored object has 'void prefetch()' method, it is exposed as prefetch().
  */
 template <typename SIGNATURE, size_t STORAGE_SIZE = 64>
 class FixedFunction;
@@ -46,16 +68,21 @@ public:
             return static_cast<unref_type *>(object_ptr)->operator()(args...);
         };
 
-        m_alloc_ptr = [](void *storage_ptr, void *object_ptr) {
-            if (object_ptr) {
-                unref_type *object = static_cast<unref_type *>(object_ptr);
-                new (storage_ptr) unref_type(std::move(*object));
-            } else {
+        m_alloc_ptr = [](Operation operation, void *storage_ptr, void *object_ptr) {
+            switch (operation) {
+            case Operation::Move:
+                new (storage_ptr) unref_type(std::move(*static_cast<unref_type *>(object_ptr)));
+                break;
+            case Operation::Destroy:
                 static_cast<unref_type *>(storage_ptr)->~unref_type();
+                break;
+            case Operation::Prefetch:
+                prefetchObject(*static_cast<unref_type *>(storage_ptr));
+                break;
             }
         };
 
-        m_alloc_ptr(&m_storage, &object);
+        m_alloc_ptr(Operation::Move, &m_storage, &object);
     }
 
     template <typename RET, typename... PARAMS>
@@ -72,6 +99,8 @@ public:
     }
 
     FixedFunction(FixedFunction &&o)
+        : m_method_ptr(nullptr)
+        , m_alloc_ptr(nullptr)
     {
         moveFromOther(o);
     }
@@ -85,7 +114,7 @@ public:
     ~FixedFunction()
     {
         if (m_alloc_ptr)
-            (*m_alloc_ptr)(&m_storage, nullptr);
+            (*m_alloc_ptr)(Operation::Destroy, &m_storage, nullptr);
     }
 
     /**
@@ -99,6 +128,16 @@ public:
         return (*m_method_ptr)(&m_storage, m_function_ptr, args...);
     }
 
+    /**
+     * @brief prefetch Call 'prefetch()' of stored functional object if it has one.
+     * It lets the object bring data it is going to use to cache ahead of the call.
+     */
+    void prefetch()
+    {
+        if (m_alloc_ptr)
+            (*m_alloc_ptr)(Operation::Prefetch, &m_storage, nullptr);
+    }
+
 private:
     FixedFunction & operator=(const FixedFunction &) = delete;
     FixedFunction(const FixedFunction &) = delete;
@@ -111,7 +150,9 @@ private:
     typedef R(*method_type)(void *object_ptr, func_ptr_type free_func_ptr, ARGS... args);
     method_type m_method_ptr;
 
-    typedef void(*alloc_type)(void *storage_ptr, void *object_ptr);
+    enum class Operation { Move, Destroy, Prefetch };
+
+    typedef void(*alloc_type)(Operation operation, void *storage_ptr, void *object_ptr);
     alloc_type m_alloc_ptr;
 
     void moveFromOther(FixedFunction &o)
@@ -119,9 +160,15 @@ private:
         if (this == &o)
             return;
 
+        if (m_alloc_ptr)
+            (*m_alloc_ptr)(Operation::Destroy, &m_storage, nullptr);
+
         m_method_ptr = o.m_method_ptr;
         m_alloc_ptr = o.m_alloc_ptr;
-        m_alloc_ptr(&m_storage, &o.m_storage);
+        if (m_alloc_ptr)
+            (*m_alloc_ptr)(Operation::Move, &m_storage, &o.m_storage);
+        else
+            m_function_ptr = o.m_function_ptr;
     }
 };
 
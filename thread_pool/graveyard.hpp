@@ -0,0 +1,261 @@
+#ifndef GRAVEYARD_HPP
+#define GRAVEYARD_HPP
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/**
+ * @brief The Graveyard class keeps objects whose destruction was deferred by a worker.
+ * Every worker owns one and destroys the buried objects in small batches in its idle
+ * step, so expensive destructors don't stall the worker between tasks. Under sustained
+ * load, when the graveyard holds more than half of Limit objects or more than ByteLimit
+ * bytes, the worker also destroys a batch after each task, so memory is reclaimed even
+ * if the worker never gets idle. When the graveyard is full, objects are destroyed
+ * immediately. Objects are kept in a ring allocated on construction.
+ * The class is not thread safe, it is used by the owner worker's thread only.
+ */
+class Graveyard {
+public:
+    static const size_t Limit = 256;
+    static const size_t ByteLimit = 64 * 1024 * 1024;
+    static const size_t BatchSize = 16;
+
+    Graveyard();
+
+    /**
+     * @brief ~Graveyard Destroy all buried objects.
+     */
+    ~Graveyard();
+
+    /**
+     * @brief bury Schedule object destruction.
+     * @param object Object to destroy.
+     * @param deleter Function destroying the object.
+     * @param bytes Memory owned by the object.
+     */
+    void bury(void *object, void (*deleter)(void *), size_t bytes);
+
+    /**
+     * @brief drain Destroy the oldest buried objects.
+     * @param max_count Maximum number of objects to destroy.
+     * @return Number of destroyed objects.
+     */
+    size_t drain(size_t max_count);
+
+    /**
+     * @brief overloaded Returns true if buried objects should be destroyed between tasks.
+     */
+    bool overloaded() const;
+
+    /**
+     * @brief size Returns number of buried objects.
+     */
+    size_t size() const;
+
+    /**
+     * @brief getBytes Returns memory owned by buried objects.
+     */
+    size_t getBytes() const;
+
+    /**
+     * @brief current Returns the graveyard of the calling thread or nullptr.
+     */
+    static Graveyard * current();
+
+    /**
+     * @brief setCurrent Set the graveyard of the calling thread.
+     */
+    static void setCurrent(Graveyard *graveyard);
+
+private:
+    Graveyard(const Graveyard&) = delete;
+    Graveyard & operator=(const Graveyard&) = delete;
+
+    struct Corpse {
+        void *object;
+        void (*deleter)(void *);
+        size_t bytes;
+    };
+
+    static Graveyard *& currentRef();
+
+    std::unique_ptr<Corpse[]> m_corpses;
+    size_t m_head;
+    size_t m_count;
+    size_t m_bytes;
+};
+
+/**
+ * @brief The Deferred class owns a heap object whose destruction is deferred to
+ * the idle time of the worker it is destroyed on. Capture heavy state of a task
+ * in Deferred to keep its destructor off the worker's hot path. Destroyed outside
+ * of worker threads, it destroys the object immediately.
+ */
+template <typename T>
+class Deferred {
+public:
+    /**
+     * @brief Deferred Constructor.
+     * @param value Object to be moved to the heap.
+     * @param bytes Memory owned by the object, counted against Graveyard::ByteLimit.
+     * Pass the size of its heap buffers for objects like big containers.
+     */
+    explicit Deferred(T &&value, size_t bytes = sizeof(T));
+
+    Deferred(Deferred &&other);
+    Deferred & operator=(Deferred &&other);
+
+    /**
+     * @brief ~Deferred Bury the object in the current worker's graveyard.
+     */
+    ~Deferred();
+
+    T & operator*() const;
+    T * operator->() const;
+    T * get() const;
+
+private:
+    Deferred(const Deferred&) = delete;
+    Deferred & operator=(const Deferred&) = delete;
+
+    void reset();
+
+    T *m_object;
+    size_t m_bytes;
+};
+
+/**
+ * @brief makeDeferred Construct object owned by Deferred.
+ */
+template <typename T, typename... Args>
+Deferred<T> makeDeferred(Args&&... args);
+
+
+/// Implementation
+
+inline Graveyard::Graveyard()
+    : m_corpses(new Corpse[Limit])
+    , m_head(0)
+    , m_count(0)
+    , m_bytes(0) {
+}
+
+inline Graveyard::~Graveyard() {
+    drain(m_count);
+}
+
+inline Graveyard *& Graveyard::currentRef() {
+    static thread_local Graveyard *graveyard = nullptr;
+    return graveyard;
+}
+
+inline Graveyard * Graveyard::current() {
+    return currentRef();
+}
+
+inline void Graveyard::setCurrent(Graveyard *graveyard) {
+    currentRef() = graveyard;
+}
+
+inline void Graveyard::bury(void *object, void (*deleter)(void *), size_t bytes) {
+    if (m_count == Limit) {
+        deleter(object);
+        return;
+    }
+    m_corpses[(m_head + m_count) % Limit] = Corpse{object, deleter, bytes};
+    ++m_count;
+    m_bytes += bytes;
+}
+
+inline size_t Graveyard::drain(size_t max_count) {
+    size_t count = 0;
+    while (count < max_count && m_count != 0) {
+        Corpse corpse = m_corpses[m_head];
+        m_head = (m_head + 1) % Limit;
+        --m_count;
+        m_bytes -= corpse.bytes;
+        corpse.deleter(corpse.object);
+        ++count;
+    }
+    return count;
+}
+
+inline bool Graveyard::overloaded() const {
+    return m_count > Limit / 2 || m_bytes > ByteLimit;
+}
+
+inline size_t Graveyard::size() const {
+    return m_count;
+}
+
+inline size_t Graveyard::getBytes() const {
+    return m_bytes;
+}
+
+template <typename T>
+inline Deferred<T>::Deferred(T &&value, size_t bytes)
+    : m_object(new T(std::move(value)))
+    , m_bytes(bytes) {
+}
+
+template <typename T>
+inline Deferred<T>::Deferred(Deferred &&other)
+    : m_object(other.m_object)
+    , m_bytes(other.m_bytes) {
+    other.m_object = nullptr;
+}
+
+template <typename T>
+inline Deferred<T> & Deferred<T>::operator=(Deferred &&other) {
+    if (this != &other) {
+        reset();
+        m_object = other.m_object;
+        m_bytes = other.m_bytes;
+        other.m_object = nullptr;
+    }
+    return *this;
+}
+
+template <typename T>
+inline Deferred<T>::~Deferred() {
+    reset();
+}
+
+template <typename T>
+inline void Deferred<T>::reset() {
+    if (!m_object) {
+        return;
+    }
+
+    auto deleter = [](void *object) { delete static_cast<T *>(object); };
+    Graveyard *graveyard = Graveyard::current();
+    if (graveyard) {
+        graveyard->bury(m_object, deleter, m_bytes);
+    } else {
+        deleter(m_object);
+    }
+    m_object = nullptr;
+}
+
+template <typename T>
+inline T & Deferred<T>::operator*() const {
+    return *m_object;
+}
+
+template <typename T>
+inline T * Deferred<T>::operator->() const {
+    return m_object;
+}
+
+template <typename T>
+inline T * Deferred<T>::get() const {
+    return m_object;
+}
+
+template <typename T, typename... Args>
+inline Deferred<T> makeDeferred(Args&&... args) {
+    return Deferred<T>(T(std::forward<Args>(args)...));
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef HASH_AGGREGATE_HPP
+#define HASH_AGGREGATE_HPP
+
+#include <parallel_for.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The HashAggregate class implements parallel group-by aggregation.
+ * Phase one hashes all keys and radix partitions row indices by the high hash bits:
+ * every participant counts its chunk of rows per partition, and after a prefix sum
+ * scatters them to disjoint parts of one array, so no locks or atomics are needed.
+ * Partitions are sized to fit cache. Phase two aggregates each partition in its own
+ * open addressing table; all rows of a key fall into one partition, so tables are
+ * never shared and need no merging.
+ * @tparam Key Group key type, should be copy constructible and equality comparable.
+ * @tparam Value Aggregate type, should be copy constructible.
+ * @tparam Hash Hash function of keys.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class HashAggregate {
+public:
+    typedef std::vector<std::pair<Key, Value>> Result;
+
+    /**
+     * @brief HashAggregate Constructor.
+     * @param pool Thread pool to run the aggregation in.
+     * @param partition_bytes Target size of partition data, should fit in worker's cache.
+     * @param hash Hash function.
+     */
+    explicit HashAggregate(ThreadPool &pool, size_t partition_bytes = 256 * 1024, Hash hash = Hash());
+
+    /**
+     * @brief run Aggregate rows of [first, last) grouped by key.
+     * @param key Callable as 'key(row)' returning group key.
+     * @param init Initial aggregate value of every group.
+     * @param aggregate Callable as 'aggregate(Value &accumulator, row)'.
+     * @return Groups with their aggregates in unspecified order.
+     */
+    template <typename Iterator, typename KeyFn, typename AggregateFn>
+    Result run(Iterator first, Iterator last, KeyFn key, const Value &init, AggregateFn aggregate);
+
+private:
+    struct Entry {
+        uint64_t hash;
+        size_t row;
+    };
+
+    static uint64_t mix(uint64_t hash);
+
+    ThreadPool &m_pool;
+    const size_t m_partition_bytes;
+    Hash m_hash;
+};
+
+/**
+ * @brief hashAggregate Aggregate rows of [first, last) grouped by key with HashAggregate.
+ * @param key Callable as 'key(row)' returning group key.
+ * @param init Initial aggregate value of every group.
+ * @param aggregate Callable as 'aggregate(Value &accumulator, row)'.
+ * @return Pairs of group key and aggregate in unspecified order.
+ */
+template <typename Iterator, typename KeyFn, typename Value, typename AggregateFn,
+          typename Key = typename std::decay<
+              typename std::result_of<KeyFn(typename std::iterator_traits<Iterator>::reference)>::type>::type>
+std::vector<std::pair<Key, Value>> hashAggregate(ThreadPool &pool, Iterator first, Iterator last,
+                                                 KeyFn key, const Value &init, AggregateFn aggregate);
+
+
+/// Implementation
+
+template <typename Key, typename Value, typename Hash>
+inline HashAggregate<Key, Value, Hash>::HashAggregate(ThreadPool &pool, size_t partition_bytes, Hash hash)
+    : m_pool(pool)
+    , m_partition_bytes(std::max<size_t>(partition_bytes, 4096))
+    , m_hash(hash) {
+}
+
+template <typename Key, typename Value, typename Hash>
+inline uint64_t HashAggregate<Key, Value, Hash>::mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+template <typename Key, typename Value, typename Hash>
+template <typename Iterator, typename KeyFn, typename AggregateFn>
+inline typename HashAggregate<Key, Value, Hash>::Result
+HashAggregate<Key, Value, Hash>::run(Iterator first, Iterator last, KeyFn key, const Value &init,
+                                     AggregateFn aggregate) {
+    const size_t rows = static_cast<size_t>(last - first);
+    if (rows == 0) {
+        return Result();
+    }
+
+    const size_t chunks = std::min(m_pool.getWorkerCount() + 1, rows);
+    const size_t row_bytes = sizeof(Entry) + sizeof(Key) + sizeof(Value);
+    size_t radix_bits = 0;
+    while ((size_t(1) << radix_bits) < chunks * 4
+           || (rows >> radix_bits) * row_bytes > m_partition_bytes) {
+        if (++radix_bits == 16) {
+            break;
+        }
+    }
+    const size_t partitions = size_t(1) << radix_bits;
+    const size_t shift = 64 - radix_bits;
+    auto partitionOf = [shift](uint64_t hash) -> size_t {
+        return shift == 64 ? 0 : static_cast<size_t>(hash >> shift);
+    };
+
+    // Phase one: hash and count per chunk, then scatter to per-partition ranges.
+    std::vector<uint64_t> hashes(rows);
+    std::vector<size_t> offsets(chunks * partitions, 0);
+
+    ParallelFor::run(m_pool, chunks, [&](size_t chunk) {
+        size_t *counts = &offsets[chunk * partitions];
+        for (size_t row = rows * chunk / chunks, end = rows * (chunk + 1) / chunks; row < end; ++row) {
+            hashes[row] = mix(m_hash(key(first[row])));
+            ++counts[partitionOf(hashes[row])];
+        }
+    });
+
+    std::vector<size_t> partition_begin(partitions + 1, 0);
+    size_t offset = 0;
+    for (size_t partition = 0; partition < partitions; ++partition) {
+        partition_begin[partition] = offset;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            size_t count = offsets[chunk * partitions + partition];
+            offsets[chunk * partitions + partition] = offset;
+            offset += count;
+        }
+    }
+    partition_begin[partitions] = offset;
+
+    std::vector<Entry> entries(rows);
+    ParallelFor::run(m_pool, chunks, [&](size_t chunk) {
+        size_t *cursors = &offsets[chunk * partitions];
+        for (size_t row = rows * chunk / chunks, end = rows * (chunk + 1) / chunks; row < end; ++row) {
+            entries[cursors[partitionOf(hashes[row])]++] = Entry{hashes[row], row};
+        }
+    });
+
+    // Phase two: aggregate every partition in a private open addressing table.
+    std::vector<Result> results(partitions);
+    ParallelFor::run(m_pool, partitions, [&](size_t partition) {
+        const size_t begin = partition_begin[partition];
+        const size_t end = partition_begin[partition + 1];
+        if (begin == end) {
+            return;
+        }
+
+        size_t capacity = 16;
+        while (capacity < (end - begin) * 2) {
+            capacity <<= 1;
+        }
+        std::vector<size_t> slots(capacity, 0);
+        std::vector<uint64_t> group_hashes;
+        Result &groups = results[partition];
+
+        for (size_t i = begin; i < end; ++i) {
+            const Entry &entry = entries[i];
+            auto &&row = first[entry.row];
+            auto &&row_key = key(row);
+
+            size_t slot = static_cast<size_t>(entry.hash) & (capacity - 1);
+            while (true) {
+                size_t group = slots[slot];
+                if (group == 0) {
+                    groups.emplace_back(row_key, init);
+                    group_hashes.push_back(entry.hash);
+                    slots[slot] = groups.size();
+                    aggregate(groups.back().second, row);
+                    break;
+                }
+                if (group_hashes[group - 1] == entry.hash && groups[group - 1].first == row_key) {
+                    aggregate(groups[group - 1].second, row);
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+    });
+
+    size_t groups_count = 0;
+    for (const auto &groups : results) {
+        groups_count += groups.size();
+    }
+
+    Result result;
+    result.reserve(groups_count);
+    for (auto &groups : results) {
+        std::move(groups.begin(), groups.end(), std::back_inserter(result));
+    }
+    return result;
+}
+
+template <typename Iterator, typename KeyFn, typename Value, typename AggregateFn, typename Key>
+inline std::vector<std::pair<Key, Value>> hashAggregate(ThreadPool &pool, Iterator first, Iterator last,
+                                                        KeyFn key, const Value &init, AggregateFn aggregate) {
+    return HashAggregate<Key, Value>(pool).run(first, last, key, init, aggregate);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef INTRUSIVE_QUEUE_HPP
+#define INTRUSIVE_QUEUE_HPP
+
+#include <atomic>
+
+/**
+ * @brief The IntrusiveNode struct is the hook objects embed to be linked into
+ * IntrusiveMpscQueue.
+ */
+struct IntrusiveNode {
+    std::atomic<IntrusiveNode *> next{nullptr};
+};
+
+/**
+ * @brief The IntrusiveMpscQueue class implements Dmitry Vyukov's intrusive
+ * multi-producer single-consumer queue.
+ * Producers link nodes with one atomic exchange, the consumer unlinks them without
+ * atomic read-modify-write operations. Nodes are neither copied nor allocated, their
+ * owners keep them alive until they are popped. A node may be pushed again once popped.
+ * Push never fails and is wait-free. Pop may miss a node whose push is in progress.
+ */
+class IntrusiveMpscQueue {
+public:
+    IntrusiveMpscQueue();
+
+    /**
+     * @brief push Link node to the queue. May be called from any thread.
+     * @param node Node which is not in the queue.
+     */
+    void push(IntrusiveNode *node);
+
+    /**
+     * @brief pop Unlink the oldest node. Should be called from the consumer thread only.
+     * @return Node or nullptr if the queue is empty or the next push is not complete yet.
+     */
+    IntrusiveNode * pop();
+
+    /**
+     * @brief empty Returns true if there are no nodes. Should be called from the consumer thread only.
+     */
+    bool empty() const;
+
+private:
+    IntrusiveMpscQueue(const IntrusiveMpscQueue&) = delete;
+    IntrusiveMpscQueue & operator=(const IntrusiveMpscQueue&) = delete;
+
+    typedef char Cacheline[64];
+
+    Cacheline pad0;
+    std::atomic<IntrusiveNode *> m_head;
+    Cacheline pad1;
+    IntrusiveNode *m_tail;
+    IntrusiveNode m_stub;
+};
+
+
+/// Implementation
+
+inline IntrusiveMpscQueue::IntrusiveMpscQueue()
+    : m_head(&m_stub)
+    , m_tail(&m_stub) {
+}
+
+inline void IntrusiveMpscQueue::push(IntrusiveNode *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    IntrusiveNode *prev = m_head.exchange(node, std::memory_order_seq_cst);
+    prev->next.store(node, std::memory_order_release);
+}
+
+inline IntrusiveNode * IntrusiveMpscQueue::pop() {
+    IntrusiveNode *tail = m_tail;
+    IntrusiveNode *next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &m_stub) {
+        if (!next) {
+            return nullptr;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+
+    if (tail != m_head.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // The tail is the last node, the stub is put behind it to unlink it.
+    push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+inline bool IntrusiveMpscQueue::empty() const {
+    return m_tail == &m_stub && m_head.load(std::memory_order_seq_cst) == &m_stub;
+}
+
+#endif
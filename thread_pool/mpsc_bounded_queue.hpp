@@ -4,14 +4,26 @@
 #include <atomic>
 #include <type_traits>
 #include <cstddef>
-#include <vector>
+#include <cstdlib>
+#include <new>
 #include <stdexcept>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define MPMC_QUEUE_MMAP 1
+#endif
+
 /**
  * @brief The MPMCBoundedQueue class implements bounded multi-producers/multi-consumers lock-free queue.
  * Doesn't accept non-movabe types as T.
  * Inspired by Dmitry Vyukov's mpmc queue.
  * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * Cells live in zero-filled anonymous memory which is only reserved on construction.
+ * Cell sequence is stored relative to the cell index, so a zero-filled cell is a
+ * ready-to-push one, and items are constructed in place on push and destroyed on pop.
+ * Thus a page of the buffer is committed only when the queue grows into it.
  */
 template <typename T>
 class MPMCBoundedQueue {
@@ -21,9 +33,15 @@ public:
      * @brief MPMCBoundedQueue Constructor.
      * @param size Power of 2 number - queue length.
      * @throws std::invalid_argument if size is bad.
+     * @throws std::bad_alloc if buffer can't be reserved.
      */
     explicit MPMCBoundedQueue(size_t size);
 
+    /**
+     * @brief ~MPMCBoundedQueue Destroy items left in queue and release buffer.
+     */
+    ~MPMCBoundedQueue();
+
     /**
      * @brief push Push data to queue.
      * @param data Data to be pushed.
@@ -32,6 +50,23 @@ public:
     template <typename U>
     bool push(U &&data);
 
+    /**
+     * @brief pushConstructed Push item constructed by factory once a cell is claimed.
+     * The factory is not called if queue is full, so nothing is consumed by a failed push.
+     * @param make Callable returning the item or a value it is constructed from.
+     * @return true on success.
+     */
+    template <typename Factory>
+    bool pushConstructed(Factory &&make);
+
+    /**
+     * @brief pushBulk Push several items to queue claiming their cells with a single CAS.
+     * @param data Pointer to the first item. Pushed items are moved from.
+     * @param count Number of items to push.
+     * @return Number of items pushed. Always the leading part of the range, 0 if queue is full.
+     */
+    size_t pushBulk(T *data, size_t count);
+
     /**
      * @brief pop Pop data from queue.
      * @param data Place to store popped data.
@@ -39,20 +74,53 @@ public:
      */
     bool pop(T &data);
 
+    /**
+     * @brief size Approximate number of items in queue.
+     * @return Queue length observed at some moment of the call.
+     */
+    size_t size() const;
+
+    /**
+     * @brief getResidentMemory Returns number of buffer bytes committed so far.
+     * Every cell up to the highest one ever pushed is counted, rounded up to whole pages.
+     */
+    size_t getResidentMemory() const;
+
+    /**
+     * @brief getReservedMemory Returns number of buffer bytes reserved for the queue.
+     */
+    size_t getReservedMemory() const;
+
+    /**
+     * @brief prefault Commit the whole buffer now instead of page by page on growth.
+     * May be called while other threads use the queue: pages are committed by atomic
+     * no-op updates of cell sequences. Pages holding no sequence, which exist only if
+     * a cell is bigger than a page, are left to be committed on growth.
+     */
+    void prefault();
+
 private:
     MPMCBoundedQueue(const MPMCBoundedQueue&) = delete;
     MPMCBoundedQueue & operator=(const MPMCBoundedQueue&) = delete;
 
     struct Cell {
         std::atomic<size_t> sequence;
-        T data;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
     };
 
+    static size_t pageSize();
+
+    size_t loadSequence(size_t pos) const;
+    void storeSequence(size_t pos, size_t seq);
+    T * item(size_t pos);
+
     typedef char Cacheline[64];
 
     Cacheline pad0;
-    std::vector<Cell> m_buffer;
+    Cell *m_buffer;
     const size_t m_buffer_mask;
+    const size_t m_buffer_bytes;
+    std::atomic<bool> m_prefaulted;
     Cacheline pad1;
     std::atomic<size_t> m_enqueue_pos;
     Cacheline pad2;
@@ -65,8 +133,10 @@ private:
 
 template <typename T>
 inline MPMCBoundedQueue<T>::MPMCBoundedQueue(size_t size)
-    : m_buffer(size)
+    : m_buffer(nullptr)
     , m_buffer_mask(size - 1)
+    , m_buffer_bytes((size * sizeof(Cell) + pageSize() - 1) / pageSize() * pageSize())
+    , m_prefaulted(false)
     , m_enqueue_pos(0)
     , m_dequeue_pos(0)
 {
@@ -75,21 +145,85 @@ inline MPMCBoundedQueue<T>::MPMCBoundedQueue(size_t size)
        throw std::invalid_argument("buffer size should be a power of 2");
     }
 
-    for (size_t i = 0; i < size; ++i)
-    {
-        m_buffer[i].sequence = i;
+#ifdef MPMC_QUEUE_MMAP
+    void *buffer = ::mmap(nullptr, m_buffer_bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buffer == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#else
+    static_assert(alignof(Cell) <= alignof(std::max_align_t), "Cell is overaligned");
+    void *buffer = std::calloc(1, m_buffer_bytes);
+    if (!buffer) {
+        throw std::bad_alloc();
+    }
+#endif
+
+    m_buffer = static_cast<Cell *>(buffer);
+}
+
+template <typename T>
+inline MPMCBoundedQueue<T>::~MPMCBoundedQueue()
+{
+    size_t end = m_enqueue_pos.load(std::memory_order_acquire);
+    for (size_t pos = m_dequeue_pos.load(std::memory_order_acquire); pos != end; ++pos) {
+        if (loadSequence(pos) == pos + 1) {
+            item(pos)->~T();
+        }
     }
+
+#ifdef MPMC_QUEUE_MMAP
+    ::munmap(m_buffer, m_buffer_bytes);
+#else
+    std::free(m_buffer);
+#endif
+}
+
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::pageSize()
+{
+#ifdef MPMC_QUEUE_MMAP
+    static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+    return page_size;
+#else
+    return 4096;
+#endif
+}
+
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::loadSequence(size_t pos) const
+{
+    size_t index = pos & m_buffer_mask;
+    return m_buffer[index].sequence.load(std::memory_order_acquire) + index;
+}
+
+template <typename T>
+inline void MPMCBoundedQueue<T>::storeSequence(size_t pos, size_t seq)
+{
+    size_t index = pos & m_buffer_mask;
+    m_buffer[index].sequence.store(seq - index, std::memory_order_release);
+}
+
+template <typename T>
+inline T * MPMCBoundedQueue<T>::item(size_t pos)
+{
+    return reinterpret_cast<T *>(&m_buffer[pos & m_buffer_mask].data);
 }
 
 template <typename T>
 template <typename U>
 inline bool MPMCBoundedQueue<T>::push(U &&data)
 {
-    Cell *cell;
+    return pushConstructed([&data]() -> U && { return std::forward<U>(data); });
+}
+
+template <typename T>
+template <typename Factory>
+inline bool MPMCBoundedQueue<T>::pushConstructed(Factory &&make)
+{
     size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
     for (;;) {
-        cell = &m_buffer[pos & m_buffer_mask];
-        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        size_t seq = loadSequence(pos);
         intptr_t dif = (intptr_t)seq - (intptr_t)pos;
         if (dif == 0) {
             if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
@@ -102,21 +236,54 @@ inline bool MPMCBoundedQueue<T>::push(U &&data)
         }
     }
 
-    cell->data = std::forward<U>(data);
+    new (item(pos)) T(make());
 
-    cell->sequence.store(pos + 1, std::memory_order_release);
+    storeSequence(pos, pos + 1);
 
     return true;
 }
 
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::pushBulk(T *data, size_t count)
+{
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t claimed;
+    for (;;) {
+        claimed = 0;
+        intptr_t dif = 0;
+        while (claimed < count) {
+            size_t seq = loadSequence(pos + claimed);
+            dif = (intptr_t)seq - (intptr_t)(pos + claimed);
+            if (dif != 0) {
+                break;
+            }
+            ++claimed;
+        }
+
+        if (claimed == 0) {
+            if (dif < 0 || count == 0) {
+                return 0;
+            }
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        } else if (m_enqueue_pos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < claimed; ++i) {
+        new (item(pos + i)) T(std::move(data[i]));
+        storeSequence(pos + i, pos + i + 1);
+    }
+
+    return claimed;
+}
+
 template <typename T>
 inline bool MPMCBoundedQueue<T>::pop(T &data)
 {
-    Cell *cell;
     size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
     for (;;) {
-        cell = &m_buffer[pos & m_buffer_mask];
-        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        size_t seq = loadSequence(pos);
         intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
         if (dif == 0) {
             if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
@@ -129,11 +296,56 @@ inline bool MPMCBoundedQueue<T>::pop(T &data)
         }
     }
 
-    data = std::move(cell->data);
+    T *cell_data = item(pos);
+    data = std::move(*cell_data);
+    cell_data->~T();
 
-    cell->sequence.store(pos + m_buffer_mask + 1, std::memory_order_release);
+    storeSequence(pos, pos + m_buffer_mask + 1);
 
     return true;
 }
 
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::size() const
+{
+    size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    intptr_t dif = (intptr_t)enqueue_pos - (intptr_t)dequeue_pos;
+    return dif > 0 ? static_cast<size_t>(dif) : 0;
+}
+
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::getResidentMemory() const
+{
+    size_t touched = m_enqueue_pos.load(std::memory_order_relaxed);
+    if (m_prefaulted.load(std::memory_order_relaxed) || touched > m_buffer_mask) {
+        return m_buffer_bytes;
+    }
+
+    size_t bytes = touched * sizeof(Cell);
+    return (bytes + pageSize() - 1) / pageSize() * pageSize();
+}
+
+template <typename T>
+inline size_t MPMCBoundedQueue<T>::getReservedMemory() const
+{
+    return m_buffer_bytes;
+}
+
+template <typename T>
+inline void MPMCBoundedQueue<T>::prefault()
+{
+    // Adding zero keeps the sequence intact and makes the kernel commit the page.
+    const char *base = reinterpret_cast<const char *>(m_buffer);
+    size_t last_page = ~size_t(0);
+    for (size_t i = 0; i <= m_buffer_mask; ++i) {
+        size_t page = (reinterpret_cast<const char *>(&m_buffer[i].sequence) - base) / pageSize();
+        if (page != last_page) {
+            m_buffer[i].sequence.fetch_add(0, std::memory_order_relaxed);
+            last_page = page;
+        }
+    }
+    m_prefaulted.store(true, std::memory_order_relaxed);
+}
+
 #endif
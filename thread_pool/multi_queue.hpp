@@ -0,0 +1,246 @@
+#ifndef MULTI_QUEUE_HPP
+#define MULTI_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The MultiQueue class implements relaxed concurrent priority queue.
+ * Items are kept in several sequential binary heaps, each guarded by its own spin lock.
+ * Push puts an item to a random heap. Pop looks at the cached tops of two random heaps
+ * and takes the item from the one with the better top. There is no global lock, and with
+ * a few heaps per thread contention stays low, at the cost of approximate order: popped
+ * items are close to the best ones rather than the best.
+ * Lower priority values are popped first, so priorities may be deadlines or job sizes.
+ * @tparam T Item type, should be move constructible and move assignable.
+ */
+template <typename T>
+class MultiQueue {
+public:
+    /**
+     * @brief Empty Top priority of an empty heap. Pushed priorities are clamped below it.
+     */
+    static const uint64_t Empty = ~uint64_t(0);
+
+    /**
+     * @brief MultiQueue Constructor.
+     * @param heaps_count Number of heaps, usually a small multiple of the number of threads.
+     * @param capacity Total number of items, divided evenly between heaps.
+     */
+    MultiQueue(size_t heaps_count, size_t capacity);
+
+    /**
+     * @brief push Put item to a random heap which is not full.
+     * @param priority Item priority, lower values are popped first.
+     * @param value Item to be moved to the queue.
+     * @return false if all heaps are full.
+     */
+    template <typename U>
+    bool push(uint64_t priority, U &&value);
+
+    /**
+     * @brief pushConstructed Put item constructed by factory to a random heap which is not full.
+     * The factory is called only after a place is found, so nothing is consumed if all heaps are full.
+     * @param priority Item priority, lower values are popped first.
+     * @param make Callable returning the item or a value it is constructed from.
+     * @return false if all heaps are full.
+     */
+    template <typename Factory>
+    bool pushConstructed(uint64_t priority, Factory &&make);
+
+    /**
+     * @brief pop Take an item of the better top of two random heaps. If both are empty,
+     * all heaps are checked, so false is returned only if the queue looked empty.
+     * @param value Place for the item to be stored.
+     * @return true on success.
+     */
+    bool pop(T &value);
+
+    /**
+     * @brief getHeapCount Returns number of heaps.
+     */
+    size_t getHeapCount() const;
+
+    /**
+     * @brief getResidentMemory Returns approximate number of bytes committed by the queue.
+     */
+    size_t getResidentMemory() const;
+
+private:
+    MultiQueue(const MultiQueue&) = delete;
+    MultiQueue & operator=(const MultiQueue&) = delete;
+
+    typedef char Cacheline[64];
+
+    struct Entry {
+        uint64_t priority;
+        T value;
+
+        template <typename U>
+        Entry(uint64_t priority, U &&value)
+            : priority(priority)
+            , value(std::forward<U>(value)) {
+        }
+    };
+
+    struct Heap {
+        std::atomic<bool> locked{false};
+        std::atomic<uint64_t> top{Empty};
+        std::vector<Entry> entries;
+        Cacheline pad;
+    };
+
+    static bool later(const Entry &a, const Entry &b);
+
+    static void lock(Heap &heap);
+    static bool tryLock(Heap &heap);
+    static void unlock(Heap &heap);
+
+    /**
+     * @brief popFrom Pop the top of the locked heap and unlock it.
+     */
+    static bool popFrom(Heap &heap, T &value);
+
+    static uint64_t random();
+
+    const size_t m_heaps_count;
+    const size_t m_heap_capacity;
+    std::unique_ptr<Heap[]> m_heaps;
+};
+
+
+/// Implementation
+
+template <typename T>
+const uint64_t MultiQueue<T>::Empty;
+
+template <typename T>
+inline MultiQueue<T>::MultiQueue(size_t heaps_count, size_t capacity)
+    : m_heaps_count(std::max<size_t>(heaps_count, 1))
+    , m_heap_capacity((std::max<size_t>(capacity, 1) + m_heaps_count - 1) / m_heaps_count)
+    , m_heaps(new Heap[m_heaps_count]) {
+    for (size_t i = 0; i < m_heaps_count; ++i) {
+        m_heaps[i].entries.reserve(m_heap_capacity);
+    }
+}
+
+template <typename T>
+inline bool MultiQueue<T>::later(const Entry &a, const Entry &b) {
+    return a.priority > b.priority;
+}
+
+template <typename T>
+inline void MultiQueue<T>::lock(Heap &heap) {
+    while (!tryLock(heap)) {
+        while (heap.locked.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template <typename T>
+inline bool MultiQueue<T>::tryLock(Heap &heap) {
+    return !heap.locked.load(std::memory_order_relaxed)
+        && !heap.locked.exchange(true, std::memory_order_acquire);
+}
+
+template <typename T>
+inline void MultiQueue<T>::unlock(Heap &heap) {
+    heap.top.store(heap.entries.empty() ? Empty : heap.entries.front().priority, std::memory_order_relaxed);
+    heap.locked.store(false, std::memory_order_release);
+}
+
+template <typename T>
+inline uint64_t MultiQueue<T>::random() {
+    static std::atomic<uint64_t> seed{0};
+    static thread_local uint64_t state = 0x9e3779b97f4a7c15ull * (seed.fetch_add(1, std::memory_order_relaxed) + 1);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+template <typename T>
+template <typename U>
+inline bool MultiQueue<T>::push(uint64_t priority, U &&value) {
+    return pushConstructed(priority, [&value]() -> U && { return std::forward<U>(value); });
+}
+
+template <typename T>
+template <typename Factory>
+inline bool MultiQueue<T>::pushConstructed(uint64_t priority, Factory &&make) {
+    priority = std::min(priority, Empty - 1);
+
+    const size_t start = random() % m_heaps_count;
+    for (size_t i = 0; i < m_heaps_count; ++i) {
+        Heap &heap = m_heaps[(start + i) % m_heaps_count];
+        lock(heap);
+        if (heap.entries.size() < m_heap_capacity) {
+            heap.entries.emplace_back(priority, make());
+            std::push_heap(heap.entries.begin(), heap.entries.end(), later);
+            unlock(heap);
+            return true;
+        }
+        unlock(heap);
+    }
+    return false;
+}
+
+template <typename T>
+inline bool MultiQueue<T>::popFrom(Heap &heap, T &value) {
+    if (heap.entries.empty()) {
+        unlock(heap);
+        return false;
+    }
+    std::pop_heap(heap.entries.begin(), heap.entries.end(), later);
+    value = std::move(heap.entries.back().value);
+    heap.entries.pop_back();
+    unlock(heap);
+    return true;
+}
+
+template <typename T>
+inline bool MultiQueue<T>::pop(T &value) {
+    for (size_t attempt = 0; attempt < m_heaps_count; ++attempt) {
+        Heap *best = &m_heaps[random() % m_heaps_count];
+        Heap *other = &m_heaps[random() % m_heaps_count];
+        if (other->top.load(std::memory_order_relaxed) < best->top.load(std::memory_order_relaxed)) {
+            std::swap(best, other);
+        }
+        if (best->top.load(std::memory_order_relaxed) == Empty) {
+            break;
+        }
+        if (tryLock(*best) && popFrom(*best, value)) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < m_heaps_count; ++i) {
+        Heap &heap = m_heaps[i];
+        if (heap.top.load(std::memory_order_relaxed) == Empty) {
+            continue;
+        }
+        lock(heap);
+        if (popFrom(heap, value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+inline size_t MultiQueue<T>::getHeapCount() const {
+    return m_heaps_count;
+}
+
+template <typename T>
+inline size_t MultiQueue<T>::getResidentMemory() const {
+    return sizeof(*this) + m_heaps_count * (sizeof(Heap) + m_heap_capacity * sizeof(Entry));
+}
+
+#endif
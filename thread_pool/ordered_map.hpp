@@ -0,0 +1,233 @@
+#ifndef ORDERED_MAP_HPP
+#define ORDERED_MAP_HPP
+
+#include <thread_pool.hpp>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief The OrderedMap class transforms a stream of items on ThreadPool and
+ * releases results in input order.
+ * Items in flight live in a ring of 'window' slots. When the oldest item isn't
+ * transformed yet and the ring is full, no more items are pulled from the source.
+ * The calling thread transforms the oldest item itself if no worker has picked it
+ * up yet, so it is safe to call run() from a thread pool worker.
+ */
+template <typename Item, typename Function>
+class OrderedMap {
+public:
+    typedef typename std::decay<typename std::result_of<Function&(Item&&)>::type>::type Result;
+
+    static_assert(!std::is_void<Result>::value, "function should return a value");
+
+    /**
+     * @brief OrderedMap Constructor.
+     * @param pool Thread pool to transform items on.
+     * @param function Transformation. It has to be callable as 'function(Item&&)'
+     * concurrently from several threads.
+     * @param window Maximum number of items in flight.
+     * @throws std::invalid_argument if window is zero.
+     */
+    OrderedMap(ThreadPool &pool, Function &function, size_t window);
+
+    /**
+     * @brief run Pull all items from source and push transformed items to sink in input order.
+     * @param source Source of items. It has to be callable as 'bool source(Item &)'
+     * and return false when stream is over.
+     * @param sink Receiver of results. It has to be callable as 'sink(Result&&)'.
+     * @throws Any exception thrown by source, sink or transformation. The first exception
+     * in input order is rethrown after all items in flight are finished.
+     */
+    template <typename Source, typename Sink>
+    void run(Source &source, Sink &sink);
+
+private:
+    OrderedMap(const OrderedMap&) = delete;
+    OrderedMap & operator=(const OrderedMap&) = delete;
+
+    enum SlotState {
+        Empty,
+        Pending,
+        Running,
+        Ready
+    };
+
+    struct Slot {
+        std::atomic<int> state{Empty};
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type item;
+        typename std::aligned_storage<sizeof(Result), alignof(Result)>::type result;
+        std::exception_ptr error;
+    };
+
+    /**
+     * @brief The State struct is shared with posted tasks.
+     * Tasks may start after run() returns, then they find no pending slot and do nothing.
+     */
+    struct State {
+        explicit State(Function &function, size_t window)
+            : function(&function), slots(window) {
+        }
+
+        Function *function;
+        std::vector<Slot> slots;
+    };
+
+    static bool tryTransform(State &state, Slot &slot);
+    void finish(size_t head, size_t tail);
+
+    ThreadPool &m_pool;
+    std::shared_ptr<State> m_state;
+};
+
+/**
+ * @brief orderedMap Transform stream of items on thread pool and release results in input order.
+ * @param pool Thread pool to transform items on.
+ * @param source Source of items. It has to be callable as 'bool source(Item &)'.
+ * @param function Transformation. It has to be callable as 'function(Item&&)'.
+ * @param sink Receiver of results in input order.
+ * @param window Maximum number of items in flight.
+ * @see OrderedMap
+ */
+template <typename Item, typename Source, typename Function, typename Sink>
+void orderedMap(ThreadPool &pool, Source &&source, Function &&function, Sink &&sink, size_t window = 64);
+
+
+/// Implementation
+
+template <typename Item, typename Function>
+inline OrderedMap<Item, Function>::OrderedMap(ThreadPool &pool, Function &function, size_t window)
+    : m_pool(pool) {
+    if (0 == window) {
+        throw std::invalid_argument("window should be positive");
+    }
+    m_state = std::make_shared<State>(function, window);
+}
+
+template <typename Item, typename Function>
+inline bool OrderedMap<Item, Function>::tryTransform(State &state, Slot &slot) {
+    int expected = Pending;
+    if (!slot.state.compare_exchange_strong(expected, Running, std::memory_order_acquire)) {
+        return false;
+    }
+
+    Item *item = reinterpret_cast<Item *>(&slot.item);
+    try {
+        new (&slot.result) Result((*state.function)(std::move(*item)));
+    } catch (...) {
+        slot.error = std::current_exception();
+    }
+    item->~Item();
+
+    slot.state.store(Ready, std::memory_order_release);
+    return true;
+}
+
+template <typename Item, typename Function>
+template <typename Source, typename Sink>
+inline void OrderedMap<Item, Function>::run(Source &source, Sink &sink) {
+    State &state = *m_state;
+    const size_t window = state.slots.size();
+    size_t head = 0;
+    size_t tail = 0;
+    bool exhausted = false;
+
+    try {
+        Item item;
+        for (;;) {
+            while (!exhausted && tail - head < window) {
+                if (!source(item)) {
+                    exhausted = true;
+                    break;
+                }
+
+                const size_t index = tail % window;
+                Slot &slot = state.slots[index];
+                new (&slot.item) Item(std::move(item));
+                slot.state.store(Pending, std::memory_order_release);
+                ++tail;
+
+                try {
+                    m_pool.post([state = m_state, index](size_t) {
+                        tryTransform(*state, state->slots[index]);
+                    });
+                } catch (const std::overflow_error &) {
+                    tryTransform(state, slot);
+                }
+            }
+
+            if (head == tail) {
+                break;
+            }
+
+            Slot &slot = state.slots[head % window];
+            if (slot.state.load(std::memory_order_acquire) != Ready && !tryTransform(state, slot)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            ++head;
+            if (slot.error) {
+                std::exception_ptr error = std::move(slot.error);
+                slot.error = nullptr;
+                slot.state.store(Empty, std::memory_order_relaxed);
+                std::rethrow_exception(error);
+            }
+
+            Result *result = reinterpret_cast<Result *>(&slot.result);
+            struct Release {
+                Slot &slot;
+                Result *result;
+                ~Release() {
+                    result->~Result();
+                    slot.state.store(Empty, std::memory_order_relaxed);
+                }
+            } release{slot, result};
+
+            sink(std::move(*result));
+        }
+    } catch (...) {
+        finish(head, tail);
+        throw;
+    }
+}
+
+template <typename Item, typename Function>
+inline void OrderedMap<Item, Function>::finish(size_t head, size_t tail) {
+    State &state = *m_state;
+    const size_t window = state.slots.size();
+
+    for (; head != tail; ++head) {
+        Slot &slot = state.slots[head % window];
+
+        int expected = Pending;
+        if (slot.state.compare_exchange_strong(expected, Empty, std::memory_order_acquire)) {
+            reinterpret_cast<Item *>(&slot.item)->~Item();
+            continue;
+        }
+
+        while (slot.state.load(std::memory_order_acquire) != Ready) {
+            std::this_thread::yield();
+        }
+
+        if (slot.error) {
+            slot.error = nullptr;
+        } else {
+            reinterpret_cast<Result *>(&slot.result)->~Result();
+        }
+        slot.state.store(Empty, std::memory_order_relaxed);
+    }
+}
+
+template <typename Item, typename Source, typename Function, typename Sink>
+inline void orderedMap(ThreadPool &pool, Source &&source, Function &&function, Sink &&sink, size_t window) {
+    typedef typename std::remove_reference<Function>::type FunctionType;
+    OrderedMap<Item, FunctionType> mapper(pool, function, window);
+    mapper.run(source, sink);
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef PARALLEL_FOR_HPP
+#define PARALLEL_FOR_HPP
+
+#include <thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The TileOrder enum selects the order tiles of a multi-dimensional space are handed out in.
+ *  - RowMajor: x changes fastest.
+ *  - Morton: Z-order curve, bits of tile coordinates interleaved.
+ *  - Hilbert: Hilbert curve, consecutive tiles are always neighbours.
+ */
+enum class TileOrder {
+    RowMajor,
+    Morton,
+    Hilbert
+};
+
+/**
+ * @brief The TileShape struct holds tile size along each dimension.
+ */
+struct TileShape {
+    size_t x = 64;
+    size_t y = 64;
+    size_t z = 1;
+};
+
+/**
+ * @brief The ParallelFor class implements the driver shared by parallel loops.
+ * Items are split into one contiguous range per participant: the calling thread
+ * and one helper task per worker. A participant runs its own range first and then
+ * takes items from the other ranges, so neighbouring items tend to run on the same
+ * thread while load is still balanced. The caller participates and waits for all
+ * items, so loops may be nested in pool tasks. The first exception thrown by the
+ * body cancels items not started yet and is rethrown to the caller.
+ */
+class ParallelFor {
+public:
+    /**
+     * @brief run Call body(item) for each item in [0, count) using the pool.
+     * @param pool Thread pool to run helper tasks in.
+     * @param count Number of items.
+     * @param body Callable as 'body(size_t item)'.
+     */
+    template <typename Body>
+    static void run(ThreadPool &pool, size_t count, Body &&body);
+
+    /**
+     * @brief tileOrder Returns row-major indices of tiles of the grid in the given order.
+     * @param counts Number of tiles along x, y and z.
+     * @param order Curve to order tiles along.
+     */
+    static std::vector<size_t> tileOrder(const size_t (&counts)[3], TileOrder order);
+
+    /**
+     * @brief defaultGrain Returns chunk length giving several chunks per participant.
+     * @param pool Thread pool the loop runs in.
+     * @param count Number of indices.
+     */
+    static size_t defaultGrain(ThreadPool &pool, size_t count);
+
+private:
+    typedef char Cacheline[64];
+
+    struct Range {
+        std::atomic<size_t> next;
+        size_t end;
+        Cacheline pad;
+    };
+
+    class State {
+    public:
+        State(size_t count, size_t participants, void *body, void (*call)(void *, size_t));
+
+        void work(size_t participant);
+        bool finished() const;
+        void rethrow();
+
+    private:
+        void execute(size_t item);
+
+        std::unique_ptr<Range[]> m_ranges;
+        const size_t m_participants;
+        const size_t m_count;
+        void *m_body;
+        void (*m_call)(void *, size_t);
+        std::atomic<size_t> m_completed;
+        std::atomic<bool> m_failed;
+        std::mutex m_mutex;
+        std::exception_ptr m_error;
+    };
+
+    static uint64_t curveKey(uint32_t (&coords)[3], size_t dims, size_t bits, TileOrder order);
+};
+
+/**
+ * @brief parallelForChunks Call func(chunk_begin, chunk_end) for consecutive chunks of [begin, end).
+ * @param pool Thread pool to run the loop in.
+ * @param grain Chunk length. Zero selects one giving several chunks per participant.
+ */
+template <typename Func>
+void parallelForChunks(ThreadPool &pool, size_t begin, size_t end, size_t grain, Func &&func);
+
+/**
+ * @brief parallelFor Call func(i) for each i in [begin, end).
+ * @param pool Thread pool to run the loop in.
+ * @param grain Number of consecutive indices run by one claim. Zero selects automatically.
+ */
+template <typename Func>
+void parallelFor(ThreadPool &pool, size_t begin, size_t end, Func &&func, size_t grain = 0);
+
+/**
+ * @brief parallelFor2d Call func(x_begin, x_end, y_begin, y_end) for each tile of width x height space.
+ * @param pool Thread pool to run the loop in.
+ * @param tile Tile shape, z is ignored.
+ * @param order Order tiles are handed out in. Participants get contiguous pieces of it.
+ * @throws std::invalid_argument if a tile dimension is zero.
+ */
+template <typename Func>
+void parallelFor2d(ThreadPool &pool, size_t width, size_t height, TileShape tile, Func &&func,
+                   TileOrder order = TileOrder::Hilbert);
+
+/**
+ * @brief parallelFor3d Call func(x_begin, x_end, y_begin, y_end, z_begin, z_end) for each tile
+ * of width x height x depth space.
+ * @param pool Thread pool to run the loop in.
+ * @param tile Tile shape.
+ * @param order Order tiles are handed out in. Participants get contiguous pieces of it.
+ * @throws std::invalid_argument if a tile dimension is zero.
+ */
+template <typename Func>
+void parallelFor3d(ThreadPool &pool, size_t width, size_t height, size_t depth, TileShape tile,
+                   Func &&func, TileOrder order = TileOrder::Hilbert);
+
+
+/// Implementation
+
+inline ParallelFor::State::State(size_t count, size_t participants, void *body, void (*call)(void *, size_t))
+    : m_ranges(new Range[participants])
+    , m_participants(participants)
+    , m_count(count)
+    , m_body(body)
+    , m_call(call)
+    , m_completed(0)
+    , m_failed(false) {
+    for (size_t i = 0; i < participants; ++i) {
+        m_ranges[i].next.store(count * i / participants, std::memory_order_relaxed);
+        m_ranges[i].end = count * (i + 1) / participants;
+    }
+}
+
+inline void ParallelFor::State::execute(size_t item) {
+    if (!m_failed.load(std::memory_order_relaxed)) {
+        try {
+            m_call(m_body, item);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error) {
+                m_error = std::current_exception();
+            }
+            m_failed.store(true, std::memory_order_relaxed);
+        }
+    }
+    m_completed.fetch_add(1, std::memory_order_release);
+}
+
+inline void ParallelFor::State::work(size_t participant) {
+    for (size_t i = 0; i < m_participants; ++i) {
+        Range &range = m_ranges[(participant + i) % m_participants];
+        while (range.next.load(std::memory_order_relaxed) < range.end) {
+            size_t item = range.next.fetch_add(1, std::memory_order_relaxed);
+            if (item >= range.end) {
+                break;
+            }
+            execute(item);
+        }
+    }
+}
+
+inline bool ParallelFor::State::finished() const {
+    return m_completed.load(std::memory_order_acquire) == m_count;
+}
+
+inline void ParallelFor::State::rethrow() {
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+template <typename Body>
+inline void ParallelFor::run(ThreadPool &pool, size_t count, Body &&body) {
+    if (count == 0) {
+        return;
+    }
+
+    typedef typename std::remove_reference<Body>::type BodyType;
+    const size_t participants = std::min(pool.getWorkerCount() + 1, count);
+    void *body_ptr = const_cast<void *>(static_cast<const void *>(&body));
+    auto state = std::make_shared<State>(count, participants, body_ptr, [](void *body, size_t item) {
+        (*static_cast<BodyType *>(body))(item);
+    });
+
+    for (size_t i = 1; i < participants; ++i) {
+        try {
+            pool.post([state, i](size_t) { state->work(i); });
+        } catch (const std::overflow_error &) {
+            break;
+        }
+    }
+
+    state->work(0);
+    while (!state->finished()) {
+        std::this_thread::yield();
+    }
+    state->rethrow();
+}
+
+inline uint64_t ParallelFor::curveKey(uint32_t (&coords)[3], size_t dims, size_t bits, TileOrder order) {
+    if (order == TileOrder::Hilbert && dims > 1) {
+        // Skilling's transform of coordinates to the transposed Hilbert index.
+        for (uint32_t q = uint32_t(1) << (bits - 1); q > 1; q >>= 1) {
+            uint32_t p = q - 1;
+            for (size_t i = 0; i < dims; ++i) {
+                if (coords[i] & q) {
+                    coords[0] ^= p;
+                } else {
+                    uint32_t t = (coords[0] ^ coords[i]) & p;
+                    coords[0] ^= t;
+                    coords[i] ^= t;
+                }
+            }
+        }
+        for (size_t i = 1; i < dims; ++i) {
+            coords[i] ^= coords[i - 1];
+        }
+        uint32_t t = 0;
+        for (uint32_t q = uint32_t(1) << (bits - 1); q > 1; q >>= 1) {
+            if (coords[dims - 1] & q) {
+                t ^= q - 1;
+            }
+        }
+        for (size_t i = 0; i < dims; ++i) {
+            coords[i] ^= t;
+        }
+    }
+
+    // Hilbert index has the first coordinate most significant, Morton - the last one.
+    uint64_t key = 0;
+    for (size_t bit = bits; bit-- > 0;) {
+        for (size_t i = 0; i < dims; ++i) {
+            const size_t axis = order == TileOrder::Hilbert ? i : dims - 1 - i;
+            key = (key << 1) | ((coords[axis] >> bit) & 1);
+        }
+    }
+    return key;
+}
+
+inline std::vector<size_t> ParallelFor::tileOrder(const size_t (&counts)[3], TileOrder order) {
+    const size_t total = counts[0] * counts[1] * counts[2];
+    std::vector<size_t> tiles(total);
+    for (size_t i = 0; i < total; ++i) {
+        tiles[i] = i;
+    }
+    if (order == TileOrder::RowMajor || total < 2) {
+        return tiles;
+    }
+
+    const size_t dims = counts[2] > 1 ? 3 : 2;
+    const size_t largest = std::max(counts[0], std::max(counts[1], counts[2]));
+    size_t bits = 1;
+    while ((size_t(1) << bits) < largest) {
+        ++bits;
+    }
+    if (bits * dims > 64) {
+        throw std::invalid_argument("too many tiles");
+    }
+
+    std::vector<std::pair<uint64_t, size_t>> keys(total);
+    for (size_t i = 0; i < total; ++i) {
+        uint32_t coords[3] = {
+            static_cast<uint32_t>(i % counts[0]),
+            static_cast<uint32_t>(i / counts[0] % counts[1]),
+            static_cast<uint32_t>(i / counts[0] / counts[1])
+        };
+        keys[i] = std::make_pair(curveKey(coords, dims, bits, order), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (size_t i = 0; i < total; ++i) {
+        tiles[i] = keys[i].second;
+    }
+    return tiles;
+}
+
+inline size_t ParallelFor::defaultGrain(ThreadPool &pool, size_t count) {
+    return std::max<size_t>(1, count / ((pool.getWorkerCount() + 1) * 8));
+}
+
+template <typename Func>
+inline void parallelForChunks(ThreadPool &pool, size_t begin, size_t end, size_t grain, Func &&func) {
+    if (end <= begin) {
+        return;
+    }
+
+    const size_t count = end - begin;
+    if (grain == 0) {
+        grain = ParallelFor::defaultGrain(pool, count);
+    }
+
+    ParallelFor::run(pool, (count + grain - 1) / grain, [&](size_t chunk) {
+        size_t chunk_begin = begin + chunk * grain;
+        func(chunk_begin, std::min(chunk_begin + grain, end));
+    });
+}
+
+template <typename Func>
+inline void parallelFor(ThreadPool &pool, size_t begin, size_t end, Func &&func, size_t grain) {
+    parallelForChunks(pool, begin, end, grain, [&](size_t chunk_begin, size_t chunk_end) {
+        for (size_t i = chunk_begin; i < chunk_end; ++i) {
+            func(i);
+        }
+    });
+}
+
+template <typename Func>
+inline void parallelFor2d(ThreadPool &pool, size_t width, size_t height, TileShape tile, Func &&func,
+                          TileOrder order) {
+    tile.z = 1;
+    parallelFor3d(pool, width, height, 1, tile, [&](size_t x_begin, size_t x_end, size_t y_begin,
+                                                    size_t y_end, size_t, size_t) {
+        func(x_begin, x_end, y_begin, y_end);
+    }, order);
+}
+
+template <typename Func>
+inline void parallelFor3d(ThreadPool &pool, size_t width, size_t height, size_t depth, TileShape tile,
+                          Func &&func, TileOrder order) {
+    if (tile.x == 0 || tile.y == 0 || tile.z == 0) {
+        throw std::invalid_argument("tile dimensions should be positive");
+    }
+    if (width == 0 || height == 0 || depth == 0) {
+        return;
+    }
+
+    const size_t counts[3] = {
+        (width + tile.x - 1) / tile.x,
+        (height + tile.y - 1) / tile.y,
+        (depth + tile.z - 1) / tile.z
+    };
+    const std::vector<size_t> tiles = ParallelFor::tileOrder(counts, order);
+
+    ParallelFor::run(pool, tiles.size(), [&](size_t item) {
+        const size_t index = tiles[item];
+        const size_t x = index % counts[0] * tile.x;
+        const size_t y = index / counts[0] % counts[1] * tile.y;
+        const size_t z = index / counts[0] / counts[1] * tile.z;
+        func(x, std::min(x + tile.x, width), y, std::min(y + tile.y, height), z, std::min(z + tile.z, depth));
+    });
+}
+
+#endif
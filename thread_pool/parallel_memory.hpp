@@ -0,0 +1,214 @@
+#ifndef PARALLEL_MEMORY_HPP
+#define PARALLEL_MEMORY_HPP
+
+#include <parallel_for.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief The ParallelMemory struct holds tuning of the parallel memory operations.
+ * Buffers are split into chunks whose boundaries are page aligned in the destination,
+ * so no page is written by two workers. Every participant of the loop gets a contiguous
+ * run of chunks (see ParallelFor). Which worker a participant runs on changes from call
+ * to call, so the NUMA placement of pages is not controlled.
+ * Large copies and fills use SSE2 non-temporal stores, so the destination doesn't evict
+ * the working set of other tasks from cache.
+ */
+struct ParallelMemory {
+    /**
+     * @brief SerialThreshold Sizes below it are processed by the calling thread.
+     */
+    static const size_t SerialThreshold = 256 * 1024;
+
+    /**
+     * @brief StreamThreshold Sizes starting from it are written with non-temporal stores.
+     */
+    static const size_t StreamThreshold = 8 * 1024 * 1024;
+
+    /**
+     * @brief ChunkAlignment Chunk boundaries alignment in the destination.
+     */
+    static const size_t ChunkAlignment = 4096;
+
+    /**
+     * @brief run Call func(offset, length) for page-aligned chunks of size bytes at base.
+     */
+    template <typename Func>
+    static void run(ThreadPool &pool, const void *base, size_t size, Func &&func);
+
+    static void streamCopy(char *dst, const char *src, size_t size);
+    static void streamFill(char *dst, int value, size_t size);
+};
+
+/**
+ * @brief parallelMemcpy Copy size bytes from src to dst using the pool. Buffers should not overlap.
+ */
+void parallelMemcpy(ThreadPool &pool, void *dst, const void *src, size_t size);
+
+/**
+ * @brief parallelMemset Fill size bytes at dst with value using the pool.
+ */
+void parallelMemset(ThreadPool &pool, void *dst, int value, size_t size);
+
+/**
+ * @brief parallelMemcmp Compare size bytes of two buffers using the pool.
+ * @return The same sign as std::memcmp would return.
+ */
+int parallelMemcmp(ThreadPool &pool, const void *lhs, const void *rhs, size_t size);
+
+
+/// Implementation
+
+template <typename Func>
+inline void ParallelMemory::run(ThreadPool &pool, const void *base, size_t size, Func &&func) {
+    const size_t participants = pool.getWorkerCount() + 1;
+    size_t chunk = (size / (participants * 4) + ChunkAlignment - 1) / ChunkAlignment * ChunkAlignment;
+    if (chunk == 0) {
+        chunk = ChunkAlignment;
+    }
+
+    // The first chunk ends at a page boundary, so all following ones start at one.
+    const size_t head = (ChunkAlignment - reinterpret_cast<uintptr_t>(base) % ChunkAlignment) % ChunkAlignment;
+    auto boundary = [head, chunk, size](size_t index) {
+        return index == 0 ? 0 : std::min(size, head + index * chunk);
+    };
+
+    size_t count = 1;
+    while (boundary(count) < size) {
+        ++count;
+    }
+
+    ParallelFor::run(pool, count, [&](size_t index) {
+        size_t begin = boundary(index);
+        func(begin, boundary(index + 1) - begin);
+    });
+}
+
+inline void ParallelMemory::streamCopy(char *dst, const char *src, size_t size) {
+#ifdef __SSE2__
+    size_t head = (16 - reinterpret_cast<uintptr_t>(dst) % 16) % 16;
+    if (size < head + 64) {
+        std::memcpy(dst, src, size);
+        return;
+    }
+
+    std::memcpy(dst, src, head);
+    size_t offset = head;
+    for (; offset + 64 <= size; offset += 64) {
+        const __m128i *from = reinterpret_cast<const __m128i *>(src + offset);
+        __m128i *to = reinterpret_cast<__m128i *>(dst + offset);
+        __m128i a = _mm_loadu_si128(from);
+        __m128i b = _mm_loadu_si128(from + 1);
+        __m128i c = _mm_loadu_si128(from + 2);
+        __m128i d = _mm_loadu_si128(from + 3);
+        _mm_stream_si128(to, a);
+        _mm_stream_si128(to + 1, b);
+        _mm_stream_si128(to + 2, c);
+        _mm_stream_si128(to + 3, d);
+    }
+    std::memcpy(dst + offset, src + offset, size - offset);
+    _mm_sfence();
+#else
+    std::memcpy(dst, src, size);
+#endif
+}
+
+inline void ParallelMemory::streamFill(char *dst, int value, size_t size) {
+#ifdef __SSE2__
+    size_t head = (16 - reinterpret_cast<uintptr_t>(dst) % 16) % 16;
+    if (size < head + 64) {
+        std::memset(dst, value, size);
+        return;
+    }
+
+    std::memset(dst, value, head);
+    const __m128i pattern = _mm_set1_epi8(static_cast<char>(value));
+    size_t offset = head;
+    for (; offset + 64 <= size; offset += 64) {
+        __m128i *to = reinterpret_cast<__m128i *>(dst + offset);
+        _mm_stream_si128(to, pattern);
+        _mm_stream_si128(to + 1, pattern);
+        _mm_stream_si128(to + 2, pattern);
+        _mm_stream_si128(to + 3, pattern);
+    }
+    std::memset(dst + offset, value, size - offset);
+    _mm_sfence();
+#else
+    std::memset(dst, value, size);
+#endif
+}
+
+inline void parallelMemcpy(ThreadPool &pool, void *dst, const void *src, size_t size) {
+    if (size < ParallelMemory::SerialThreshold) {
+        std::memcpy(dst, src, size);
+        return;
+    }
+
+    char *to = static_cast<char *>(dst);
+    const char *from = static_cast<const char *>(src);
+    const bool stream = size >= ParallelMemory::StreamThreshold;
+    ParallelMemory::run(pool, dst, size, [=](size_t offset, size_t length) {
+        if (stream) {
+            ParallelMemory::streamCopy(to + offset, from + offset, length);
+        } else {
+            std::memcpy(to + offset, from + offset, length);
+        }
+    });
+}
+
+inline void parallelMemset(ThreadPool &pool, void *dst, int value, size_t size) {
+    if (size < ParallelMemory::SerialThreshold) {
+        std::memset(dst, value, size);
+        return;
+    }
+
+    char *to = static_cast<char *>(dst);
+    const bool stream = size >= ParallelMemory::StreamThreshold;
+    ParallelMemory::run(pool, dst, size, [=](size_t offset, size_t length) {
+        if (stream) {
+            ParallelMemory::streamFill(to + offset, value, length);
+        } else {
+            std::memset(to + offset, value, length);
+        }
+    });
+}
+
+inline int parallelMemcmp(ThreadPool &pool, const void *lhs, const void *rhs, size_t size) {
+    if (size < ParallelMemory::SerialThreshold) {
+        return std::memcmp(lhs, rhs, size);
+    }
+
+    const char *a = static_cast<const char *>(lhs);
+    const char *b = static_cast<const char *>(rhs);
+
+    // The difference with the lowest offset decides, chunks past a known one are skipped.
+    std::atomic<size_t> first_difference{size};
+    int result = 0;
+    std::mutex mutex;
+
+    ParallelMemory::run(pool, lhs, size, [&](size_t offset, size_t length) {
+        if (offset > first_difference.load(std::memory_order_relaxed)) {
+            return;
+        }
+        int chunk_result = std::memcmp(a + offset, b + offset, length);
+        if (chunk_result != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (offset < first_difference.load(std::memory_order_relaxed)) {
+                first_difference.store(offset, std::memory_order_relaxed);
+                result = chunk_result;
+            }
+        }
+    });
+
+    return result;
+}
+
+#endif
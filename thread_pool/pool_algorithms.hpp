@@ -0,0 +1,226 @@
+#ifndef POOL_ALGORITHMS_HPP
+#define POOL_ALGORITHMS_HPP
+
+#include <parallel_for.hpp>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief The PoolExecutionPolicy class binds parallel algorithms to a ThreadPool.
+ * The algorithms below mirror the standard ones taking an execution policy, but run
+ * through parallelForChunks on the bound pool instead of starting their own threads.
+ * Iterators should be random access. Element functions may run concurrently and
+ * in any order; reduction operations should be associative.
+ */
+class PoolExecutionPolicy {
+public:
+    /**
+     * @brief PoolExecutionPolicy Constructor.
+     * @param pool Thread pool to run algorithms in. Should outlive the policy.
+     * @param grain Elements per chunk. Zero selects automatically.
+     */
+    explicit PoolExecutionPolicy(ThreadPool &pool, size_t grain = 0);
+
+    /**
+     * @brief getPool Returns the bound thread pool.
+     */
+    ThreadPool & getPool() const;
+
+    /**
+     * @brief getGrain Returns chunk length for the given number of elements.
+     */
+    size_t getGrain(size_t count) const;
+
+    /**
+     * @brief withGrain Returns policy bound to the same pool with another chunk length.
+     */
+    PoolExecutionPolicy withGrain(size_t grain) const;
+
+private:
+    ThreadPool *m_pool;
+    size_t m_grain;
+};
+
+/**
+ * @brief forEach Call func(element) for each element of [first, last).
+ */
+template <typename Iterator, typename Func>
+void forEach(const PoolExecutionPolicy &policy, Iterator first, Iterator last, Func func);
+
+/**
+ * @brief forEachN Call func(element) for each of the first n elements.
+ * @return Iterator past the last processed element.
+ */
+template <typename Iterator, typename Func>
+Iterator forEachN(const PoolExecutionPolicy &policy, Iterator first, size_t n, Func func);
+
+/**
+ * @brief transform Store op(element) for each element of [first, last) to output.
+ * @return Output iterator past the last stored element.
+ */
+template <typename Iterator, typename OutputIterator, typename UnaryOp>
+OutputIterator transform(const PoolExecutionPolicy &policy, Iterator first, Iterator last,
+                         OutputIterator output, UnaryOp op);
+
+/**
+ * @brief transform Store op(a, b) for pairs of elements of [first1, last1) and first2 to output.
+ * @return Output iterator past the last stored element.
+ */
+template <typename Iterator1, typename Iterator2, typename OutputIterator, typename BinaryOp>
+OutputIterator transform(const PoolExecutionPolicy &policy, Iterator1 first1, Iterator1 last1,
+                         Iterator2 first2, OutputIterator output, BinaryOp op);
+
+/**
+ * @brief reduce Combine init and all elements of [first, last) with op.
+ * Chunk results are combined in order, so op needs to be associative, not commutative.
+ */
+template <typename Iterator, typename T, typename BinaryOp>
+T reduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init, BinaryOp op);
+
+/**
+ * @brief reduce Sum init and all elements of [first, last).
+ */
+template <typename Iterator, typename T>
+T reduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init);
+
+/**
+ * @brief transformReduce Combine init and transform_op(element) for all elements of [first, last)
+ * with reduce_op.
+ */
+template <typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+T transformReduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init,
+                  BinaryOp reduce_op, UnaryOp transform_op);
+
+/**
+ * @brief fill Assign value to each element of [first, last).
+ */
+template <typename Iterator, typename T>
+void fill(const PoolExecutionPolicy &policy, Iterator first, Iterator last, const T &value);
+
+/**
+ * @brief countIf Returns number of elements of [first, last) satisfying pred.
+ */
+template <typename Iterator, typename Predicate>
+size_t countIf(const PoolExecutionPolicy &policy, Iterator first, Iterator last, Predicate pred);
+
+
+/// Implementation
+
+inline PoolExecutionPolicy::PoolExecutionPolicy(ThreadPool &pool, size_t grain)
+    : m_pool(&pool)
+    , m_grain(grain) {
+}
+
+inline ThreadPool & PoolExecutionPolicy::getPool() const {
+    return *m_pool;
+}
+
+inline size_t PoolExecutionPolicy::getGrain(size_t count) const {
+    return m_grain ? m_grain : ParallelFor::defaultGrain(*m_pool, count);
+}
+
+inline PoolExecutionPolicy PoolExecutionPolicy::withGrain(size_t grain) const {
+    return PoolExecutionPolicy(*m_pool, grain);
+}
+
+template <typename Iterator, typename Func>
+inline Iterator forEachN(const PoolExecutionPolicy &policy, Iterator first, size_t n, Func func) {
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                  typename std::iterator_traits<Iterator>::iterator_category>::value,
+                  "Should be random access iterator");
+
+    parallelForChunks(policy.getPool(), 0, n, policy.getGrain(n), [&](size_t begin, size_t end) {
+        for (Iterator it = first + begin, chunk_end = first + end; it != chunk_end; ++it) {
+            func(*it);
+        }
+    });
+    return first + n;
+}
+
+template <typename Iterator, typename Func>
+inline void forEach(const PoolExecutionPolicy &policy, Iterator first, Iterator last, Func func) {
+    forEachN(policy, first, static_cast<size_t>(last - first), func);
+}
+
+template <typename Iterator, typename OutputIterator, typename UnaryOp>
+inline OutputIterator transform(const PoolExecutionPolicy &policy, Iterator first, Iterator last,
+                                OutputIterator output, UnaryOp op) {
+    const size_t count = static_cast<size_t>(last - first);
+    parallelForChunks(policy.getPool(), 0, count, policy.getGrain(count), [&](size_t begin, size_t end) {
+        OutputIterator out = output + begin;
+        for (Iterator it = first + begin, chunk_end = first + end; it != chunk_end; ++it, ++out) {
+            *out = op(*it);
+        }
+    });
+    return output + count;
+}
+
+template <typename Iterator1, typename Iterator2, typename OutputIterator, typename BinaryOp>
+inline OutputIterator transform(const PoolExecutionPolicy &policy, Iterator1 first1, Iterator1 last1,
+                                Iterator2 first2, OutputIterator output, BinaryOp op) {
+    const size_t count = static_cast<size_t>(last1 - first1);
+    parallelForChunks(policy.getPool(), 0, count, policy.getGrain(count), [&](size_t begin, size_t end) {
+        Iterator2 it2 = first2 + begin;
+        OutputIterator out = output + begin;
+        for (Iterator1 it1 = first1 + begin, chunk_end = first1 + end; it1 != chunk_end; ++it1, ++it2, ++out) {
+            *out = op(*it1, *it2);
+        }
+    });
+    return output + count;
+}
+
+template <typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+inline T transformReduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init,
+                         BinaryOp reduce_op, UnaryOp transform_op) {
+    const size_t count = static_cast<size_t>(last - first);
+    if (count == 0) {
+        return init;
+    }
+
+    const size_t grain = policy.getGrain(count);
+    std::vector<T> partials((count + grain - 1) / grain, init);
+
+    parallelForChunks(policy.getPool(), 0, count, grain, [&](size_t begin, size_t end) {
+        Iterator it = first + begin;
+        T partial = transform_op(*it);
+        for (Iterator chunk_end = first + end; ++it != chunk_end;) {
+            partial = reduce_op(partial, transform_op(*it));
+        }
+        partials[begin / grain] = std::move(partial);
+    });
+
+    for (auto &partial : partials) {
+        init = reduce_op(init, partial);
+    }
+    return init;
+}
+
+template <typename Iterator, typename T, typename BinaryOp>
+inline T reduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init, BinaryOp op) {
+    typedef typename std::iterator_traits<Iterator>::reference Reference;
+    return transformReduce(policy, first, last, init, op, [](Reference value) -> Reference {
+        return value;
+    });
+}
+
+template <typename Iterator, typename T>
+inline T reduce(const PoolExecutionPolicy &policy, Iterator first, Iterator last, T init) {
+    return reduce(policy, first, last, init, [](const T &a, const T &b) { return a + b; });
+}
+
+template <typename Iterator, typename T>
+inline void fill(const PoolExecutionPolicy &policy, Iterator first, Iterator last, const T &value) {
+    forEach(policy, first, last, [&value](typename std::iterator_traits<Iterator>::reference element) {
+        element = value;
+    });
+}
+
+template <typename Iterator, typename Predicate>
+inline size_t countIf(const PoolExecutionPolicy &policy, Iterator first, Iterator last, Predicate pred) {
+    typedef typename std::iterator_traits<Iterator>::reference Reference;
+    return transformReduce(policy, first, last, size_t(0), [](size_t a, size_t b) { return a + b; },
+                           [&pred](Reference value) -> size_t { return pred(value) ? 1 : 0; });
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef POOL_SIMULATOR_HPP
+#define POOL_SIMULATOR_HPP
+
+#include <balancing.hpp>
+#include <trace_recorder.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/**
+ * @brief The SimulatedTask struct describes one task of a simulated workload.
+ * A task with non-zero depth posts 'fanout' children from its worker when it
+ * finishes, each with the same duration and depth decreased by one.
+ */
+struct SimulatedTask {
+    uint64_t arrival = 0;   ///< Post time in nanoseconds.
+    uint64_t duration = 0;  ///< Execution time in nanoseconds.
+    uint32_t fanout = 0;
+    uint32_t depth = 0;
+};
+
+/**
+ * @brief The SimulatorOptions struct holds parameters of the modelled pool.
+ */
+struct SimulatorOptions {
+    size_t workers_count = 4;
+    size_t worker_queue_size = 1024;
+    BalancingStrategy balancing = BalancingStrategy::Hybrid;
+    uint64_t dispatch_cost = 50;    ///< Nanoseconds to pop and start a task.
+    uint64_t steal_cost = 200;      ///< Nanoseconds per steal attempt.
+    uint64_t wakeup_latency = 50000; ///< Nanoseconds an idle sleep oversleeps.
+};
+
+/**
+ * @brief The SimulatorReport struct holds results of one simulation run.
+ * Latencies are in nanoseconds. Start latency is measured from post to start,
+ * sojourn latency - from post to completion.
+ */
+struct SimulatorReport {
+    uint64_t makespan = 0;
+    double utilization = 0;
+    size_t executed = 0;
+    size_t rejected = 0;
+    size_t steals = 0;
+    size_t failed_steals = 0;
+    size_t sleeps = 0;
+    uint64_t start_p50 = 0;
+    uint64_t start_p99 = 0;
+    uint64_t start_max = 0;
+    uint64_t sojourn_p50 = 0;
+    uint64_t sojourn_p99 = 0;
+    uint64_t sojourn_max = 0;
+    std::vector<size_t> executed_per_worker;
+};
+
+/**
+ * @brief The PoolSimulator class is a deterministic discrete-event model of ThreadPool.
+ * Workers take tasks with the same BalancingPolicy placement, donor order, steal rotation
+ * and idle sleep as Worker does, while time advances by the modelled costs instead of
+ * the wall clock. Like the real pool, a sleeping worker doesn't notice new tasks before
+ * its sleep is over, and a post to a full queue is rejected.
+ * Identical workloads and options always give identical reports.
+ */
+class PoolSimulator {
+public:
+    /**
+     * @brief PoolSimulator Constructor.
+     * @param options Modelled pool parameters.
+     */
+    explicit PoolSimulator(const SimulatorOptions &options = SimulatorOptions());
+
+    /**
+     * @brief run Simulate the workload from start till all tasks are finished.
+     * @param workload External tasks. Need not be sorted by arrival.
+     * @return Simulation results.
+     */
+    SimulatorReport run(const std::vector<SimulatedTask> &workload);
+
+    /**
+     * @brief fromTrace Convert recorded trace to a workload.
+     * @param trace Records loaded with TraceRecorder::load().
+     * @param unmeasured_duration Duration used for records without one.
+     */
+    static std::vector<SimulatedTask> fromTrace(const std::vector<TraceRecord> &trace,
+                                                uint64_t unmeasured_duration);
+
+private:
+    enum EventType {
+        Arrival,
+        Finish,
+        Wakeup
+    };
+
+    struct Event {
+        uint64_t time;
+        uint64_t sequence;
+        EventType type;
+        size_t index;
+
+        bool operator>(const Event &other) const {
+            return time != other.time ? time > other.time : sequence > other.sequence;
+        }
+    };
+
+    struct Job {
+        SimulatedTask task;
+        uint64_t posted;
+    };
+
+    struct SimulatedWorker {
+        std::deque<Job> queue;
+        std::vector<size_t> donors;
+        size_t steal_cursor = 0;
+        Job current;
+        uint64_t busy_time = 0;
+        size_t executed = 0;
+    };
+
+    void schedule(uint64_t time, EventType type, size_t index);
+    void post(uint64_t time, size_t local, const SimulatedTask &task);
+    void dispatch(uint64_t time, size_t id);
+
+    static uint64_t percentile(std::vector<uint64_t> &values, double p);
+
+    SimulatorOptions m_options;
+    std::vector<SimulatedWorker> m_workers;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+    uint64_t m_sequence;
+    size_t m_next_worker;
+    std::vector<uint64_t> m_start_latencies;
+    std::vector<uint64_t> m_sojourn_latencies;
+    SimulatorReport m_report;
+};
+
+
+/// Implementation
+
+inline PoolSimulator::PoolSimulator(const SimulatorOptions &options)
+    : m_options(options)
+    , m_sequence(0)
+    , m_next_worker(0) {
+    if (m_options.workers_count == 0) {
+        m_options.workers_count = 1;
+    }
+}
+
+inline std::vector<SimulatedTask> PoolSimulator::fromTrace(const std::vector<TraceRecord> &trace,
+                                                           uint64_t unmeasured_duration) {
+    std::vector<SimulatedTask> workload;
+    workload.reserve(trace.size());
+
+    const uint64_t first = trace.empty() ? 0 : std::min_element(trace.begin(), trace.end(),
+        [](const TraceRecord &a, const TraceRecord &b) { return a.post_time < b.post_time; })->post_time;
+
+    for (const auto &record : trace) {
+        SimulatedTask task;
+        task.arrival = record.post_time - first;
+        task.duration = record.duration != TraceRecord::Unmeasured ? record.duration : unmeasured_duration;
+        workload.push_back(task);
+    }
+    return workload;
+}
+
+inline void PoolSimulator::schedule(uint64_t time, EventType type, size_t index) {
+    m_events.push(Event{time, m_sequence++, type, index});
+}
+
+inline void PoolSimulator::post(uint64_t time, size_t local, const SimulatedTask &task) {
+    size_t id = BalancingPolicy::place(m_options.balancing, m_workers.size(), local,
+        [this]() { return m_next_worker++; },
+        [this](size_t id) { return m_workers[id].queue.size(); });
+
+    SimulatedWorker &worker = m_workers[id];
+    if (worker.queue.size() >= m_options.worker_queue_size) {
+        ++m_report.rejected;
+        return;
+    }
+    worker.queue.push_back(Job{task, time});
+}
+
+inline void PoolSimulator::dispatch(uint64_t time, size_t id) {
+    SimulatedWorker &worker = m_workers[id];
+
+    size_t attempts = 0;
+    bool found = false;
+    if (!worker.queue.empty()) {
+        worker.current = worker.queue.front();
+        worker.queue.pop_front();
+        found = true;
+    } else {
+        found = BalancingPolicy::steal(worker.donors.size(), worker.steal_cursor, [&](size_t donor) {
+            ++attempts;
+            SimulatedWorker &victim = m_workers[worker.donors[donor]];
+            if (victim.queue.empty()) {
+                return false;
+            }
+            worker.current = victim.queue.front();
+            victim.queue.pop_front();
+            return true;
+        });
+        m_report.steals += found ? 1 : 0;
+        m_report.failed_steals += found ? attempts - 1 : attempts;
+    }
+
+    const uint64_t start = time + attempts * m_options.steal_cost + (found ? m_options.dispatch_cost : 0);
+    if (!found) {
+        ++m_report.sleeps;
+        const uint64_t sleep = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            BalancingPolicy::idleSleep()).count();
+        schedule(start + sleep + m_options.wakeup_latency, Wakeup, id);
+        return;
+    }
+
+    worker.busy_time += start - time + worker.current.task.duration;
+    m_start_latencies.push_back(start - worker.current.posted);
+    schedule(start + worker.current.task.duration, Finish, id);
+}
+
+inline SimulatorReport PoolSimulator::run(const std::vector<SimulatedTask> &workload) {
+    m_workers.assign(m_options.workers_count, SimulatedWorker());
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i].donors = BalancingPolicy::stealDonors(m_options.balancing, i, m_workers.size());
+    }
+    m_events = decltype(m_events)();
+    m_sequence = 0;
+    m_next_worker = 0;
+    m_start_latencies.clear();
+    m_sojourn_latencies.clear();
+    m_report = SimulatorReport();
+
+    for (size_t i = 0; i < workload.size(); ++i) {
+        schedule(workload[i].arrival, Arrival, i);
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        schedule(0, Wakeup, i);
+    }
+
+    size_t total = workload.size();
+    uint64_t now = 0;
+    while (m_report.executed + m_report.rejected < total) {
+        Event event = m_events.top();
+        m_events.pop();
+        now = event.time;
+
+        switch (event.type) {
+        case Arrival:
+            post(now, BalancingPolicy::noWorker, workload[event.index]);
+            break;
+        case Finish: {
+            SimulatedWorker &worker = m_workers[event.index];
+            const Job job = worker.current;
+            ++worker.executed;
+            ++m_report.executed;
+            m_sojourn_latencies.push_back(now - job.posted);
+            if (job.task.depth != 0) {
+                SimulatedTask child = job.task;
+                child.arrival = now;
+                --child.depth;
+                for (uint32_t i = 0; i < job.task.fanout; ++i) {
+                    ++total;
+                    post(now, event.index, child);
+                }
+            }
+            dispatch(now, event.index);
+            break;
+        }
+        case Wakeup:
+            dispatch(now, event.index);
+            break;
+        }
+    }
+
+    m_report.makespan = now;
+    uint64_t busy_time = 0;
+    for (const auto &worker : m_workers) {
+        busy_time += worker.busy_time;
+        m_report.executed_per_worker.push_back(worker.executed);
+    }
+    m_report.utilization = now ? static_cast<double>(busy_time) / (static_cast<double>(now) * m_workers.size()) : 0;
+
+    m_report.start_p50 = percentile(m_start_latencies, 0.5);
+    m_report.start_p99 = percentile(m_start_latencies, 0.99);
+    m_report.start_max = percentile(m_start_latencies, 1.0);
+    m_report.sojourn_p50 = percentile(m_sojourn_latencies, 0.5);
+    m_report.sojourn_p99 = percentile(m_sojourn_latencies, 0.99);
+    m_report.sojourn_max = percentile(m_sojourn_latencies, 1.0);
+
+    return m_report;
+}
+
+inline uint64_t PoolSimulator::percentile(std::vector<uint64_t> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef QSBR_HPP
+#define QSBR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The QsbrDomain class implements quiescent-state-based reclamation.
+ * Readers are thread pool workers. A worker announces a quiescent state between
+ * tasks by copying the global epoch to its slot, so tasks read protected data with
+ * plain loads and must not keep pointers to it after they return.
+ * Writers publish a new version, retire the old one and it is deleted once every
+ * online reader has passed a quiescent state.
+ */
+class QsbrDomain {
+public:
+    /**
+     * @brief QsbrDomain Constructor. All readers are offline initially.
+     * @param readers_count Number of reader slots.
+     */
+    explicit QsbrDomain(size_t readers_count);
+
+    /**
+     * @brief ~QsbrDomain Delete all retired objects. Readers should be offline.
+     */
+    ~QsbrDomain();
+
+    /**
+     * @brief quiescent Announce that the reader holds no protected pointers.
+     * Should be called from the reader's thread.
+     * @param reader Reader slot index.
+     */
+    void quiescent(size_t reader);
+
+    /**
+     * @brief online Start tracking the reader. Should be called from the reader's thread.
+     * @param reader Reader slot index.
+     */
+    void online(size_t reader);
+
+    /**
+     * @brief offline Stop tracking the reader. Should be called from the reader's thread.
+     * @param reader Reader slot index.
+     */
+    void offline(size_t reader);
+
+    /**
+     * @brief retire Schedule object deletion after the current grace period.
+     * @param ptr Object which is not reachable for new readers anymore.
+     * @param deleter Function deleting the object.
+     */
+    void retire(void *ptr, void (*deleter)(void *));
+
+    /**
+     * @brief retire Schedule 'delete ptr' after the current grace period.
+     * @param ptr Object which is not reachable for new readers anymore.
+     */
+    template <typename T>
+    void retire(T *ptr);
+
+    /**
+     * @brief reclaim Delete retired objects whose grace period is over.
+     * @return Number of deleted objects.
+     */
+    size_t reclaim();
+
+    /**
+     * @brief synchronize Wait until all objects retired so far can be deleted and delete them.
+     * Should not be called from a reader thread, it would wait for itself.
+     */
+    void synchronize();
+
+    /**
+     * @brief getRetiredCount Returns number of objects waiting for deletion.
+     */
+    size_t getRetiredCount() const;
+
+private:
+    QsbrDomain(const QsbrDomain&) = delete;
+    QsbrDomain & operator=(const QsbrDomain&) = delete;
+
+    static const uint64_t Offline = ~uint64_t(0);
+    static const size_t ReclaimThreshold = 64;
+
+    typedef char Cacheline[64];
+
+    struct Slot {
+        std::atomic<uint64_t> epoch{Offline};
+        Cacheline pad;
+    };
+
+    struct Retired {
+        void *ptr;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    uint64_t minimalEpoch() const;
+
+    Cacheline pad0;
+    std::atomic<uint64_t> m_epoch;
+    Cacheline pad1;
+    std::unique_ptr<Slot[]> m_slots;
+    const size_t m_slots_count;
+    mutable std::mutex m_mutex;
+    std::vector<Retired> m_retired;
+};
+
+/**
+ * @brief The QsbrPtr class holds pointer to the current version of an object
+ * protected by QsbrDomain.
+ */
+template <typename T>
+class QsbrPtr {
+public:
+    /**
+     * @brief QsbrPtr Constructor.
+     * @param domain Domain which defers deletion of replaced versions.
+     * @param initial Initial version, owned by the QsbrPtr.
+     */
+    explicit QsbrPtr(QsbrDomain &domain, T *initial = nullptr);
+
+    /**
+     * @brief ~QsbrPtr Delete the current version. There should be no readers.
+     */
+    ~QsbrPtr();
+
+    /**
+     * @brief load Returns the current version. Valid until the calling task returns.
+     */
+    T * load() const;
+
+    /**
+     * @brief publish Replace the current version. The replaced one is retired.
+     * @param value New version, owned by the QsbrPtr.
+     */
+    void publish(T *value);
+
+private:
+    QsbrPtr(const QsbrPtr&) = delete;
+    QsbrPtr & operator=(const QsbrPtr&) = delete;
+
+    QsbrDomain &m_domain;
+    std::atomic<T *> m_ptr;
+};
+
+
+/// Implementation
+
+inline QsbrDomain::QsbrDomain(size_t readers_count)
+    : m_epoch(0)
+    , m_slots(new Slot[readers_count])
+    , m_slots_count(readers_count) {
+}
+
+inline QsbrDomain::~QsbrDomain() {
+    for (auto &retired : m_retired) {
+        retired.deleter(retired.ptr);
+    }
+}
+
+inline void QsbrDomain::quiescent(size_t reader) {
+    m_slots[reader].epoch.store(m_epoch.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+inline void QsbrDomain::online(size_t reader) {
+    m_slots[reader].epoch.store(m_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline void QsbrDomain::offline(size_t reader) {
+    m_slots[reader].epoch.store(Offline, std::memory_order_release);
+}
+
+inline void QsbrDomain::retire(void *ptr, void (*deleter)(void *)) {
+    uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    size_t retired_count;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired.push_back(Retired{ptr, deleter, epoch});
+        retired_count = m_retired.size();
+    }
+
+    if (retired_count >= ReclaimThreshold) {
+        reclaim();
+    }
+}
+
+template <typename T>
+inline void QsbrDomain::retire(T *ptr) {
+    retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+}
+
+inline uint64_t QsbrDomain::minimalEpoch() const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t minimal = Offline;
+    for (size_t i = 0; i < m_slots_count; ++i) {
+        minimal = std::min(minimal, m_slots[i].epoch.load(std::memory_order_acquire));
+    }
+    return minimal;
+}
+
+inline size_t QsbrDomain::reclaim() {
+    uint64_t minimal = minimalEpoch();
+
+    std::vector<Retired> expired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::partition(m_retired.begin(), m_retired.end(), [minimal](const Retired &retired) {
+            return retired.epoch > minimal;
+        });
+        expired.assign(it, m_retired.end());
+        m_retired.erase(it, m_retired.end());
+    }
+
+    for (auto &retired : expired) {
+        retired.deleter(retired.ptr);
+    }
+    return expired.size();
+}
+
+inline void QsbrDomain::synchronize() {
+    uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    while (minimalEpoch() < epoch) {
+        std::this_thread::yield();
+    }
+    reclaim();
+}
+
+inline size_t QsbrDomain::getRetiredCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_retired.size();
+}
+
+template <typename T>
+inline QsbrPtr<T>::QsbrPtr(QsbrDomain &domain, T *initial)
+    : m_domain(domain)
+    , m_ptr(initial) {
+}
+
+template <typename T>
+inline QsbrPtr<T>::~QsbrPtr() {
+    delete m_ptr.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+inline T * QsbrPtr<T>::load() const {
+    return m_ptr.load(std::memory_order_acquire);
+}
+
+template <typename T>
+inline void QsbrPtr<T>::publish(T *value) {
+    T *old = m_ptr.exchange(value, std::memory_order_acq_rel);
+    if (old) {
+        m_domain.retire(old);
+    }
+}
+
+#endif
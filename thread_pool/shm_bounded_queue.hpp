@@ -0,0 +1,525 @@
+#ifndef SHM_BOUNDED_QUEUE_HPP
+#define SHM_BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief The SharedMPMCBoundedQueue class implements bounded multi-producers/multi-consumers
+ * lock-free queue placed in a POSIX shared memory segment.
+ * It is the same algorithm as MPMCBoundedQueue. The segment holds no pointers so every
+ * process may map it at any address. Only trivially copyable T is accepted.
+ *
+ * The creating process initializes the segment and then publishes it as ready; openers
+ * wait for that. Initialization is done under an flock() of the segment, which the kernel
+ * releases when its holder dies. So if the creator dies at any point before publishing,
+ * even before sizing the segment, the next opener knowing the queue size takes it over.
+ *
+ * Each pushed cell is stamped with the producer's pid. A producer killed between claiming
+ * a cell and publishing it blocks consumers at that cell; deadProducer() detects such a
+ * cell and skipDeadProducer() lets consumers move past it. A producer dying within a few
+ * instructions after the claim, before the stamp is written, is not detected. Liveness is
+ * checked by pid, so if the pid of a dead producer is reused by a new process before the
+ * check, the stalled cell is not detected until that process exits.
+ *
+ * Tests may define SHM_BOUNDED_QUEUE_PUBLISH_HOOK(data) before including the header; push()
+ * invokes it between stamping a claimed cell and publishing it.
+ */
+template <typename T>
+class SharedMPMCBoundedQueue {
+    static_assert(std::is_trivially_copyable<T>::value, "Should be of trivially copyable type");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                  "lock-free atomics are required for interprocess use");
+public:
+    enum class OpenMode {
+        Create,
+        Open,
+        OpenOrCreate
+    };
+
+    /**
+     * @brief SharedMPMCBoundedQueue Create or open the queue segment and map it.
+     * @param name Shared memory object name, e.g. "/my_queue".
+     * @param mode Whether the segment should be created, opened or either.
+     * @param size Power of 2 number - queue length. Used if the segment is created or taken over,
+     * zero in Open mode makes the opener wait for other process to initialize the segment.
+     * @param timeout How long to wait for other process to finish initialization.
+     * @throws std::invalid_argument if size is bad.
+     * @throws std::system_error if the segment can't be created, opened or mapped.
+     * @throws std::runtime_error if the segment is not initialized in time or holds
+     * a queue of other layout.
+     */
+    SharedMPMCBoundedQueue(const std::string &name, OpenMode mode, size_t size = 0,
+                           std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+    /**
+     * @brief ~SharedMPMCBoundedQueue Unmap the segment. The segment itself stays until unlink().
+     */
+    ~SharedMPMCBoundedQueue();
+
+    /**
+     * @brief unlink Remove shared memory object name.
+     * @param name Shared memory object name.
+     * @return true if the object existed.
+     */
+    static bool unlink(const std::string &name);
+
+    /**
+     * @brief push Push data to queue.
+     * @param data Data to be pushed.
+     * @return true on success.
+     */
+    bool push(const T &data);
+
+    /**
+     * @brief pop Pop data from queue.
+     * @param data Place to store popped data.
+     * @return true on sucess.
+     */
+    bool pop(T &data);
+
+    /**
+     * @brief size Approximate number of items in queue.
+     */
+    size_t size() const;
+
+    /**
+     * @brief deadProducer Check whether consumers are blocked by a dead producer.
+     * Makes a syscall, call it only when pop() fails while size() is not zero.
+     * @param pid Place to store dead producer pid.
+     * @return true if the head cell was claimed by a process which doesn't exist anymore.
+     */
+    bool deadProducer(pid_t &pid) const;
+
+    /**
+     * @brief skipDeadProducer Let consumers move past the cell abandoned by a dead producer.
+     * @return true if a cell was skipped.
+     */
+    bool skipDeadProducer();
+
+private:
+    SharedMPMCBoundedQueue(const SharedMPMCBoundedQueue&) = delete;
+    SharedMPMCBoundedQueue & operator=(const SharedMPMCBoundedQueue&) = delete;
+
+    enum : uint32_t {
+        Magic = 0x51504d54,
+        Uninitialized = 0,
+        Ready = 1
+    };
+
+    static constexpr uint64_t Abandoned = ~uint64_t(0);
+
+    typedef char Cacheline[64];
+
+    struct Header {
+        std::atomic<uint32_t> state;
+        uint32_t magic;
+        uint32_t item_size;
+        uint64_t capacity;
+        Cacheline pad0;
+        std::atomic<size_t> enqueue_pos;
+        Cacheline pad1;
+        std::atomic<size_t> dequeue_pos;
+        Cacheline pad2;
+    };
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        std::atomic<uint64_t> owner;
+        T data;
+    };
+
+    static size_t segmentSize(size_t size);
+    static uint64_t stamp(pid_t pid, size_t pos);
+    static bool processExists(pid_t pid);
+
+    bool create(const std::string &name);
+    void open(const std::string &name, size_t size, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief setUp Map the segment if it is ready, otherwise initialize it holding the
+     * initialization lock.
+     * @param size Queue length or zero if it is unknown and the segment can't be initialized.
+     * @param wait Wait for the lock if other process holds it instead of returning false.
+     * @return true if the segment is ready and mapped.
+     */
+    bool setUp(size_t size, bool wait);
+
+    /**
+     * @brief mapReady Map the whole segment if it is large enough to hold the header.
+     * @return true if the segment is initialized.
+     */
+    bool mapReady();
+
+    void map(size_t length);
+    void unmap();
+    void initialize(size_t size);
+    void validate();
+    bool headStall(size_t &pos, uint64_t &owner) const;
+
+    int m_fd;
+    void *m_address;
+    size_t m_length;
+    Header *m_header;
+    Cell *m_buffer;
+    size_t m_buffer_mask;
+    pid_t m_pid;
+};
+
+
+/// Implementation
+
+template <typename T>
+inline SharedMPMCBoundedQueue<T>::SharedMPMCBoundedQueue(const std::string &name, OpenMode mode, size_t size,
+                                                         std::chrono::milliseconds timeout)
+    : m_fd(-1)
+    , m_address(MAP_FAILED)
+    , m_length(0)
+    , m_header(nullptr)
+    , m_buffer(nullptr)
+    , m_buffer_mask(0)
+    , m_pid(::getpid())
+{
+    if (mode != OpenMode::Open) {
+        bool size_is_power_of_2 = (size >= 2) && ((size & (size - 1)) == 0);
+        if (!size_is_power_of_2) {
+            throw std::invalid_argument("buffer size should be a power of 2");
+        }
+    }
+
+    try {
+        if (mode != OpenMode::Open && create(name)) {
+            setUp(size, true);
+        } else {
+            if (mode == OpenMode::Create) {
+                throw std::system_error(EEXIST, std::generic_category(), "shm_open");
+            }
+            open(name, mode == OpenMode::Open ? 0 : size, timeout);
+        }
+        validate();
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+template <typename T>
+inline SharedMPMCBoundedQueue<T>::~SharedMPMCBoundedQueue()
+{
+    unmap();
+}
+
+template <typename T>
+inline void SharedMPMCBoundedQueue<T>::unmap()
+{
+    if (m_address != MAP_FAILED) {
+        ::munmap(m_address, m_length);
+        m_address = MAP_FAILED;
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::unlink(const std::string &name)
+{
+    return 0 == ::shm_unlink(name.c_str());
+}
+
+template <typename T>
+inline size_t SharedMPMCBoundedQueue<T>::segmentSize(size_t size)
+{
+    return sizeof(Header) + size * sizeof(Cell);
+}
+
+template <typename T>
+inline uint64_t SharedMPMCBoundedQueue<T>::stamp(pid_t pid, size_t pos)
+{
+    return (uint64_t(uint32_t(pid)) << 32) | uint32_t(pos);
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::processExists(pid_t pid)
+{
+    return 0 == ::kill(pid, 0) || errno != ESRCH;
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::create(const std::string &name)
+{
+    m_fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (m_fd == -1) {
+        if (errno == EEXIST) {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    return true;
+}
+
+template <typename T>
+inline void SharedMPMCBoundedQueue<T>::open(const std::string &name, size_t size,
+                                            std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (;;) {
+        if (m_fd == -1) {
+            m_fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+            if (m_fd == -1 && errno != ENOENT) {
+                throw std::system_error(errno, std::generic_category(), "shm_open");
+            }
+        }
+
+        if (m_fd != -1 && setUp(size, false)) {
+            return;
+        }
+
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error(m_fd == -1 ? "shared queue segment is not created in time"
+                                                : "shared queue segment is not initialized in time");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::setUp(size_t size, bool wait)
+{
+    if (mapReady()) {
+        return true;
+    }
+
+    if (0 != ::flock(m_fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB)) {
+        if (errno == EWOULDBLOCK) {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(), "flock");
+    }
+
+    // The lock holder is the only process initializing the segment. Whoever held
+    // it before has either published the segment or died.
+    bool ready = mapReady();
+    if (!ready && size != 0) {
+        if (0 != ::ftruncate(m_fd, segmentSize(size))) {
+            int error = errno;
+            ::flock(m_fd, LOCK_UN);
+            throw std::system_error(error, std::generic_category(), "ftruncate");
+        }
+        map(segmentSize(size));
+        initialize(size);
+        ready = true;
+    }
+
+    ::flock(m_fd, LOCK_UN);
+    return ready;
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::mapReady()
+{
+    struct stat st;
+    if (0 != ::fstat(m_fd, &st)) {
+        throw std::system_error(errno, std::generic_category(), "fstat");
+    }
+    if (size_t(st.st_size) < sizeof(Header)) {
+        return false;
+    }
+
+    if (m_address == MAP_FAILED || m_length != size_t(st.st_size)) {
+        map(st.st_size);
+    }
+    return m_header->state.load(std::memory_order_acquire) == Ready;
+}
+
+template <typename T>
+inline void SharedMPMCBoundedQueue<T>::validate()
+{
+    if (m_header->magic != Magic || m_header->item_size != sizeof(T)
+        || m_length < segmentSize(m_header->capacity)) {
+        throw std::runtime_error("shared queue segment has wrong layout");
+    }
+
+    m_buffer_mask = m_header->capacity - 1;
+}
+
+template <typename T>
+inline void SharedMPMCBoundedQueue<T>::map(size_t length)
+{
+    if (m_address != MAP_FAILED) {
+        ::munmap(m_address, m_length);
+    }
+
+    m_address = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (m_address == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+
+    m_length = length;
+    m_header = static_cast<Header *>(m_address);
+    m_buffer = reinterpret_cast<Cell *>(static_cast<char *>(m_address) + sizeof(Header));
+}
+
+template <typename T>
+inline void SharedMPMCBoundedQueue<T>::initialize(size_t size)
+{
+    m_header->state.store(Uninitialized, std::memory_order_relaxed);
+    m_header->magic = Magic;
+    m_header->item_size = sizeof(T);
+    m_header->capacity = size;
+    m_header->enqueue_pos.store(0, std::memory_order_relaxed);
+    m_header->dequeue_pos.store(0, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < size; ++i) {
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+        m_buffer[i].owner.store(0, std::memory_order_relaxed);
+    }
+
+    m_buffer_mask = size - 1;
+    m_header->state.store(Ready, std::memory_order_release);
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::push(const T &data)
+{
+    Cell *cell;
+    size_t pos = m_header->enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        cell = &m_buffer[pos & m_buffer_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (m_header->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = m_header->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->owner.store(stamp(m_pid, pos), std::memory_order_relaxed);
+#ifdef SHM_BOUNDED_QUEUE_PUBLISH_HOOK
+    SHM_BOUNDED_QUEUE_PUBLISH_HOOK(data);
+#endif
+    std::memcpy(&cell->data, &data, sizeof(T));
+
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::pop(T &data)
+{
+    for (;;) {
+        Cell *cell;
+        size_t pos = m_header->dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_buffer[pos & m_buffer_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_header->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = m_header->dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        bool abandoned = cell->owner.load(std::memory_order_relaxed) == Abandoned;
+        if (!abandoned) {
+            std::memcpy(&data, &cell->data, sizeof(T));
+        }
+
+        cell->sequence.store(pos + m_buffer_mask + 1, std::memory_order_release);
+
+        if (!abandoned) {
+            return true;
+        }
+    }
+}
+
+template <typename T>
+inline size_t SharedMPMCBoundedQueue<T>::size() const
+{
+    size_t dequeue_pos = m_header->dequeue_pos.load(std::memory_order_relaxed);
+    size_t enqueue_pos = m_header->enqueue_pos.load(std::memory_order_relaxed);
+    intptr_t dif = (intptr_t)enqueue_pos - (intptr_t)dequeue_pos;
+    return dif > 0 ? static_cast<size_t>(dif) : 0;
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::headStall(size_t &pos, uint64_t &owner) const
+{
+    pos = m_header->dequeue_pos.load(std::memory_order_acquire);
+    if (m_header->enqueue_pos.load(std::memory_order_acquire) <= pos) {
+        return false;
+    }
+
+    Cell &cell = m_buffer[pos & m_buffer_mask];
+    if (cell.sequence.load(std::memory_order_acquire) != pos) {
+        return false;
+    }
+
+    owner = cell.owner.load(std::memory_order_relaxed);
+    if (owner == Abandoned || uint32_t(owner) != uint32_t(pos)) {
+        return false;
+    }
+
+    return !processExists(pid_t(owner >> 32));
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::deadProducer(pid_t &pid) const
+{
+    size_t pos;
+    uint64_t owner;
+    if (!headStall(pos, owner)) {
+        return false;
+    }
+
+    pid = pid_t(owner >> 32);
+    return true;
+}
+
+template <typename T>
+inline bool SharedMPMCBoundedQueue<T>::skipDeadProducer()
+{
+    size_t pos;
+    uint64_t owner;
+    if (!headStall(pos, owner)) {
+        return false;
+    }
+
+    Cell &cell = m_buffer[pos & m_buffer_mask];
+    if (!cell.owner.compare_exchange_strong(owner, Abandoned, std::memory_order_relaxed)) {
+        return false;
+    }
+
+    cell.sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef SLAB_ALLOCATOR_HPP
+#define SLAB_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class SlabAllocator;
+
+/**
+ * @brief The SlabCache class is a per-worker part of SlabAllocator.
+ * It keeps a free list per size class which only the owning worker touches.
+ * Blocks freed by other threads are pushed to the lock-free remote-free list
+ * and moved back to the free lists in bulk by the owner.
+ */
+class SlabCache {
+public:
+    static const size_t ClassesCount = 8;
+    static const size_t MinBlockSize = 16;
+    static const size_t MaxBlockSize = MinBlockSize << (ClassesCount - 1);
+    static const size_t ChunkSize = 64 * 1024;
+    static const size_t RemoteBatchSize = 32;
+
+    /**
+     * @brief SlabCache Constructor.
+     * @param allocator Allocator the cache belongs to.
+     * @param id Cache index in the allocator.
+     */
+    SlabCache(SlabAllocator &allocator, size_t id);
+
+    /**
+     * @brief allocate Allocate block from the cache. Should be called from the owner thread.
+     * @param size Block size, at most MaxBlockSize.
+     * @return Block pointer aligned to 16 bytes.
+     * @throws std::bad_alloc if a new chunk can't be allocated.
+     */
+    void * allocate(size_t size);
+
+    /**
+     * @brief collect Push batched remote frees to their owners and take blocks freed by
+     * other threads back to the free lists. Called from the owner's idle step.
+     */
+    void collect();
+
+    /**
+     * @brief current Returns the cache of the calling thread or nullptr.
+     */
+    static SlabCache * current();
+
+    /**
+     * @brief setCurrent Set the cache of the calling thread.
+     */
+    static void setCurrent(SlabCache *cache);
+
+private:
+    friend class SlabAllocator;
+
+    SlabCache(const SlabCache&) = delete;
+    SlabCache & operator=(const SlabCache&) = delete;
+
+    struct Block {
+        SlabCache *owner;
+        size_t size_class;
+        Block *next;
+    };
+
+    static const size_t HeaderSize = offsetof(Block, next);
+
+    struct RemoteBatch {
+        Block *head = nullptr;
+        Block *tail = nullptr;
+        size_t count = 0;
+    };
+
+    static size_t sizeClass(size_t size);
+    static SlabCache *& currentRef();
+
+    void free(Block *block);
+    void pushRemote(Block *head, Block *tail);
+    void reclaimRemote();
+    Block * carve(size_t size_class);
+
+    typedef char Cacheline[64];
+
+    SlabAllocator &m_allocator;
+    const size_t m_id;
+    Block *m_free[ClassesCount];
+    char *m_bump[ClassesCount];
+    char *m_bump_end[ClassesCount];
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    std::vector<RemoteBatch> m_remote_batches;
+    Cacheline pad0;
+    std::atomic<Block *> m_remote_head;
+    Cacheline pad1;
+};
+
+/**
+ * @brief The SlabAllocator class implements thread pool integrated slab allocator.
+ * Every worker allocates from its own SlabCache. An object freed on its owner
+ * worker goes straight back to the owner's free list. Objects freed on another worker
+ * of the same pool are batched per owner and handed over with one CAS per batch;
+ * frees from other threads are handed over one by one.
+ * Requests larger than SlabCache::MaxBlockSize or made not from a worker thread
+ * fall back to global operator new.
+ * All blocks should be freed before the allocator is destroyed.
+ */
+class SlabAllocator {
+public:
+    /**
+     * @brief SlabAllocator Constructor.
+     * @param caches_count Number of per-worker caches.
+     */
+    explicit SlabAllocator(size_t caches_count);
+
+    /**
+     * @brief getCache Returns cache of the worker with given id.
+     */
+    SlabCache * getCache(size_t id);
+
+    /**
+     * @brief allocate Allocate memory from the calling worker's cache.
+     * @param size Size in bytes.
+     * @return Pointer aligned to 16 bytes.
+     * @throws std::bad_alloc if memory can't be allocated.
+     */
+    static void * allocate(size_t size);
+
+    /**
+     * @brief deallocate Free memory allocated with allocate(). May be called from any thread.
+     * @param ptr Pointer returned by allocate() or nullptr.
+     */
+    static void deallocate(void *ptr);
+
+    /**
+     * @brief create Allocate and construct an object.
+     */
+    template <typename T, typename... Args>
+    static T * create(Args&&... args);
+
+    /**
+     * @brief destroy Destroy and free an object made with create().
+     */
+    template <typename T>
+    static void destroy(T *object);
+
+private:
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator & operator=(const SlabAllocator&) = delete;
+
+    std::vector<std::unique_ptr<SlabCache>> m_caches;
+};
+
+
+/// Implementation
+
+inline SlabCache::SlabCache(SlabAllocator &allocator, size_t id)
+    : m_allocator(allocator)
+    , m_id(id)
+    , m_remote_head(nullptr) {
+    for (size_t i = 0; i < ClassesCount; ++i) {
+        m_free[i] = nullptr;
+        m_bump[i] = nullptr;
+        m_bump_end[i] = nullptr;
+    }
+}
+
+inline SlabCache *& SlabCache::currentRef() {
+    static thread_local SlabCache *cache = nullptr;
+    return cache;
+}
+
+inline SlabCache * SlabCache::current() {
+    return currentRef();
+}
+
+inline void SlabCache::setCurrent(SlabCache *cache) {
+    currentRef() = cache;
+}
+
+inline size_t SlabCache::sizeClass(size_t size) {
+    size_t size_class = 0;
+    size_t block_size = MinBlockSize;
+    while (block_size < size) {
+        block_size <<= 1;
+        ++size_class;
+    }
+    return size_class;
+}
+
+inline SlabCache::Block * SlabCache::carve(size_t size_class) {
+    const size_t block_size = HeaderSize + (MinBlockSize << size_class);
+
+    if (static_cast<size_t>(m_bump_end[size_class] - m_bump[size_class]) < block_size) {
+        m_chunks.emplace_back(new char[ChunkSize]);
+        m_bump[size_class] = m_chunks.back().get();
+        m_bump_end[size_class] = m_bump[size_class] + ChunkSize;
+    }
+
+    Block *block = reinterpret_cast<Block *>(m_bump[size_class]);
+    m_bump[size_class] += block_size;
+
+    block->owner = this;
+    block->size_class = size_class;
+    return block;
+}
+
+inline void * SlabCache::allocate(size_t size) {
+    const size_t size_class = sizeClass(size);
+
+    Block *block = m_free[size_class];
+    if (!block) {
+        reclaimRemote();
+        block = m_free[size_class];
+    }
+
+    if (block) {
+        m_free[size_class] = block->next;
+    } else {
+        block = carve(size_class);
+    }
+
+    return &block->next;
+}
+
+inline void SlabCache::free(Block *block) {
+    SlabCache *local = current();
+
+    if (local == this) {
+        block->next = m_free[block->size_class];
+        m_free[block->size_class] = block;
+    } else if (local && &local->m_allocator == &m_allocator) {
+        RemoteBatch &batch = local->m_remote_batches[m_id];
+        block->next = batch.head;
+        batch.head = block;
+        if (!batch.tail) {
+            batch.tail = block;
+        }
+        if (++batch.count >= RemoteBatchSize) {
+            pushRemote(batch.head, batch.tail);
+            batch = RemoteBatch();
+        }
+    } else {
+        pushRemote(block, block);
+    }
+}
+
+inline void SlabCache::pushRemote(Block *head, Block *tail) {
+    Block *remote_head = m_remote_head.load(std::memory_order_relaxed);
+    do {
+        tail->next = remote_head;
+    } while (!m_remote_head.compare_exchange_weak(remote_head, head, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+}
+
+inline void SlabCache::reclaimRemote() {
+    if (!m_remote_head.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    Block *block = m_remote_head.exchange(nullptr, std::memory_order_acquire);
+    while (block) {
+        Block *next = block->next;
+        block->next = m_free[block->size_class];
+        m_free[block->size_class] = block;
+        block = next;
+    }
+}
+
+inline void SlabCache::collect() {
+    for (auto &batch : m_remote_batches) {
+        if (batch.head) {
+            batch.head->owner->pushRemote(batch.head, batch.tail);
+            batch = RemoteBatch();
+        }
+    }
+
+    reclaimRemote();
+}
+
+inline SlabAllocator::SlabAllocator(size_t caches_count) {
+    m_caches.reserve(caches_count);
+    for (size_t i = 0; i < caches_count; ++i) {
+        m_caches.emplace_back(new SlabCache(*this, i));
+        m_caches.back()->m_remote_batches.resize(caches_count);
+    }
+}
+
+inline SlabCache * SlabAllocator::getCache(size_t id) {
+    return m_caches[id].get();
+}
+
+inline void * SlabAllocator::allocate(size_t size) {
+    SlabCache *cache = SlabCache::current();
+    if (cache && size <= SlabCache::MaxBlockSize) {
+        return cache->allocate(size);
+    }
+
+    SlabCache::Block *block = static_cast<SlabCache::Block *>(::operator new(SlabCache::HeaderSize + size));
+    block->owner = nullptr;
+    block->size_class = 0;
+    return &block->next;
+}
+
+inline void SlabAllocator::deallocate(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    SlabCache::Block *block = reinterpret_cast<SlabCache::Block *>(
+        static_cast<char *>(ptr) - SlabCache::HeaderSize);
+
+    if (block->owner) {
+        block->owner->free(block);
+    } else {
+        ::operator delete(block);
+    }
+}
+
+template <typename T, typename... Args>
+inline T * SlabAllocator::create(Args&&... args) {
+    void *memory = allocate(sizeof(T));
+    try {
+        return new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+        deallocate(memory);
+        throw;
+    }
+}
+
+template <typename T>
+inline void SlabAllocator::destroy(T *object) {
+    if (object) {
+        object->~T();
+        deallocate(object);
+    }
+}
+
+#endif
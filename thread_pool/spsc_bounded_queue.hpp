@@ -0,0 +1,127 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief The SPSCBoundedQueue class implements bounded single-producer/single-consumer
+ * wait-free queue.
+ * Each side keeps a cached copy of the other side's index, so in the common case push
+ * and pop touch only cache lines owned by the calling side.
+ * T should be default constructible and move assignable.
+ */
+template <typename T>
+class SPSCBoundedQueue {
+    static_assert(std::is_default_constructible<T>::value, "Should be of default constructible type");
+public:
+    /**
+     * @brief SPSCBoundedQueue Constructor.
+     * @param size Power of 2 number - queue length.
+     * @throws std::invalid_argument if size is bad.
+     */
+    explicit SPSCBoundedQueue(size_t size);
+
+    /**
+     * @brief push Push data to queue. Should be called from producer thread only.
+     * @param data Data to be pushed.
+     * @return true on success, false if queue is full.
+     */
+    template <typename U>
+    bool push(U &&data);
+
+    /**
+     * @brief pop Pop data from queue. Should be called from consumer thread only.
+     * @param data Place to store popped data.
+     * @return true on success, false if queue is empty.
+     */
+    bool pop(T &data);
+
+    /**
+     * @brief size Approximate number of items in queue.
+     */
+    size_t size() const;
+
+private:
+    SPSCBoundedQueue(const SPSCBoundedQueue&) = delete;
+    SPSCBoundedQueue & operator=(const SPSCBoundedQueue&) = delete;
+
+    typedef char Cacheline[64];
+
+    Cacheline pad0;
+    std::vector<T> m_buffer;
+    const size_t m_buffer_mask;
+    Cacheline pad1;
+    std::atomic<size_t> m_head;
+    size_t m_cached_tail;
+    Cacheline pad2;
+    std::atomic<size_t> m_tail;
+    size_t m_cached_head;
+    Cacheline pad3;
+};
+
+
+/// Implementation
+
+template <typename T>
+inline SPSCBoundedQueue<T>::SPSCBoundedQueue(size_t size)
+    : m_buffer(size)
+    , m_buffer_mask(size - 1)
+    , m_head(0)
+    , m_cached_tail(0)
+    , m_tail(0)
+    , m_cached_head(0)
+{
+    bool size_is_power_of_2 = (size >= 2) && ((size & (size - 1)) == 0);
+    if (!size_is_power_of_2) {
+       throw std::invalid_argument("buffer size should be a power of 2");
+    }
+}
+
+template <typename T>
+template <typename U>
+inline bool SPSCBoundedQueue<T>::push(U &&data)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head > m_buffer_mask) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        if (tail - m_cached_head > m_buffer_mask) {
+            return false;
+        }
+    }
+
+    m_buffer[tail & m_buffer_mask] = std::forward<U>(data);
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+template <typename T>
+inline bool SPSCBoundedQueue<T>::pop(T &data)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_cached_tail) {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if (head == m_cached_tail) {
+            return false;
+        }
+    }
+
+    data = std::move(m_buffer[head & m_buffer_mask]);
+    m_head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+template <typename T>
+inline size_t SPSCBoundedQueue<T>::size() const
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef SUBMISSION_BUFFER_HPP
+#define SUBMISSION_BUFFER_HPP
+
+#include <thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The SubmissionBuffer class accumulates tasks of one producer thread
+ * and posts them to ThreadPool in bulk.
+ * Buffered tasks are flushed when the buffer becomes full, when the oldest buffered
+ * task waits longer than max delay or on explicit flush() call. One flush costs one
+ * worker selection and one queue CAS instead of one per task.
+ * post() reads the clock when it buffers the first task and then every ClockCheckInterval
+ * tasks, so a task may wait longer than max delay until more tasks are posted. Without the
+ * flush timer a producer which goes idle should call one of flush() or flushIfExpired().
+ * The class is not thread safe - use one instance per producer thread.
+ */
+class SubmissionBuffer {
+public:
+    static const size_t ClockCheckInterval = 16;
+
+    /**
+     * @brief SubmissionBuffer Constructor.
+     * @param pool Thread pool to post tasks to.
+     * @param capacity Maximum number of buffered tasks.
+     * @param max_delay Maximum time the oldest task stays in buffer. Zero disables the timer.
+     * @param flush_timer Start a thread which flushes expired tasks every half of max delay,
+     * but not more often than every minTimerPeriod(), so an idle producer doesn't need to call
+     * flushIfExpired(). Buffer operations take a mutex then. Each buffer with the flag set
+     * starts its own timer thread, so it suits a few long-lived buffers.
+     * @throws std::invalid_argument if capacity is zero or flush_timer is set without max_delay.
+     */
+    explicit SubmissionBuffer(ThreadPool &pool, size_t capacity = 64,
+                              std::chrono::microseconds max_delay = std::chrono::microseconds(50),
+                              bool flush_timer = false);
+
+    /**
+     * @brief ~SubmissionBuffer Stop the flush timer and flush buffered tasks.
+     * Tasks which can't be posted because thread pool queues are full are dropped.
+     */
+    ~SubmissionBuffer();
+
+    /**
+     * @brief post Buffer piece of job for thread pool.
+     * @param handler Handler to be called from thread pool worker. It has to be callable as
+     * 'handler(WorkerContext &)' or 'handler(size_t id)', as with ThreadPool::post().
+     * @throws std::overflow_error if buffer is full and can't be flushed because all worker's queues are full.
+     */
+    template <typename Handler>
+    void post(Handler &&handler);
+
+    /**
+     * @brief flush Post all buffered tasks to thread pool.
+     * @throws std::overflow_error if all worker's queues are full. Tasks which weren't posted
+     * stay in buffer.
+     */
+    void flush();
+
+    /**
+     * @brief flushIfExpired Flush buffer if the oldest buffered task waits longer than max delay.
+     * @return true if buffer was flushed.
+     * @throws std::overflow_error in the same cases as flush().
+     */
+    bool flushIfExpired();
+
+    /**
+     * @brief size Returns the number of buffered tasks.
+     */
+    size_t size() const;
+
+    /**
+     * @brief minTimerPeriod Returns the shortest period of the flush timer.
+     */
+    static std::chrono::microseconds minTimerPeriod();
+
+private:
+    SubmissionBuffer(const SubmissionBuffer&) = delete;
+    SubmissionBuffer & operator=(const SubmissionBuffer&) = delete;
+
+    /**
+     * @brief lock Lock the buffer if the flush timer is running.
+     */
+    std::unique_lock<std::mutex> lock() const;
+
+    void flushBuffered();
+    bool flushExpired();
+
+    void timerFunc();
+
+    ThreadPool &m_pool;
+    std::vector<Worker::Task> m_tasks;
+    size_t m_size;
+    std::chrono::microseconds m_max_delay;
+    std::chrono::steady_clock::time_point m_oldest;
+
+    const bool m_flush_timer;
+    mutable std::mutex m_mutex;
+    std::atomic<bool> m_timer_running;
+    std::thread m_timer;
+};
+
+
+/// Implementation
+
+inline SubmissionBuffer::SubmissionBuffer(ThreadPool &pool, size_t capacity,
+                                          std::chrono::microseconds max_delay, bool flush_timer)
+    : m_pool(pool)
+    , m_tasks(capacity)
+    , m_size(0)
+    , m_max_delay(max_delay)
+    , m_flush_timer(flush_timer)
+    , m_timer_running(flush_timer) {
+    if (0 == capacity) {
+        throw std::invalid_argument("buffer capacity should be positive");
+    }
+    if (flush_timer && 0 == max_delay.count()) {
+        throw std::invalid_argument("flush timer requires max delay");
+    }
+
+    if (flush_timer) {
+        m_timer = std::thread(&SubmissionBuffer::timerFunc, this);
+    }
+}
+
+inline SubmissionBuffer::~SubmissionBuffer() {
+    if (m_timer.joinable()) {
+        m_timer_running.store(false, std::memory_order_relaxed);
+        m_timer.join();
+    }
+    try { flushBuffered(); } catch (...) {}
+}
+
+template <typename Handler>
+inline void SubmissionBuffer::post(Handler &&handler) {
+    auto guard = lock();
+
+    if (m_size == m_tasks.size()) {
+        flushBuffered();
+    }
+
+    if (0 == m_size && m_max_delay.count() != 0) {
+        m_oldest = std::chrono::steady_clock::now();
+    }
+
+    m_tasks[m_size++] = Worker::Task(std::forward<Handler>(handler));
+
+    if (m_size == m_tasks.size()) {
+        try { flushBuffered(); } catch (const std::overflow_error &) {}
+    } else if (0 == m_size % ClockCheckInterval) {
+        try { flushExpired(); } catch (const std::overflow_error &) {}
+    }
+}
+
+inline void SubmissionBuffer::flush() {
+    auto guard = lock();
+    flushBuffered();
+}
+
+inline bool SubmissionBuffer::flushIfExpired() {
+    auto guard = lock();
+    return flushExpired();
+}
+
+inline size_t SubmissionBuffer::size() const {
+    auto guard = lock();
+    return m_size;
+}
+
+inline std::chrono::microseconds SubmissionBuffer::minTimerPeriod() {
+    return std::chrono::microseconds(50);
+}
+
+inline std::unique_lock<std::mutex> SubmissionBuffer::lock() const {
+    if (!m_flush_timer) {
+        return std::unique_lock<std::mutex>();
+    }
+    return std::unique_lock<std::mutex>(m_mutex);
+}
+
+inline void SubmissionBuffer::flushBuffered() {
+    if (0 == m_size) {
+        return;
+    }
+
+    size_t posted = m_pool.postBulk(m_tasks.data(), m_size);
+
+    for (size_t i = posted; i < m_size; ++i) {
+        m_tasks[i - posted] = std::move(m_tasks[i]);
+    }
+    m_size -= posted;
+
+    if (0 != m_size) {
+        throw std::overflow_error("worker queue is full");
+    }
+}
+
+inline bool SubmissionBuffer::flushExpired() {
+    if (0 == m_size || 0 == m_max_delay.count()) {
+        return false;
+    }
+
+    if (std::chrono::steady_clock::now() - m_oldest < m_max_delay) {
+        return false;
+    }
+
+    flushBuffered();
+    return true;
+}
+
+inline void SubmissionBuffer::timerFunc() {
+    while (m_timer_running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::max(m_max_delay / 2, minTimerPeriod()));
+
+        try { flushIfExpired(); } catch (const std::overflow_error &) {}
+    }
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef TASK_LOG_HPP
+#define TASK_LOG_HPP
+
+#include <spsc_bounded_queue.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief The LogRecord struct is a binary log record written by a task.
+ * Format string is not copied - its address is the format id, so it has to
+ * be a string literal or otherwise outlive the log. The same applies to
+ * string arguments.
+ */
+struct LogRecord {
+    static const size_t MaxArgs = 6;
+
+    enum ArgType : uint8_t {
+        Int,
+        UInt,
+        Double,
+        String
+    };
+
+    union Arg {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char *s;
+    };
+
+    uint64_t timestamp;
+    const char *format;
+    uint16_t worker;
+    uint8_t count;
+    ArgType types[MaxArgs];
+    Arg args[MaxArgs];
+};
+
+/**
+ * @brief The TaskLog class implements structured logging from thread pool tasks.
+ * Every worker writes binary records to its own SPSC ring, which is cheap and never
+ * blocks. When a ring is full the record is dropped and counted. A background thread
+ * drains the rings periodically, formats the records and writes them to a file.
+ * Each '{}' in the format string is replaced by the next argument.
+ */
+class TaskLog {
+public:
+    typedef SPSCBoundedQueue<LogRecord> Ring;
+
+    /**
+     * @brief TaskLog Open log file and start the drainer thread.
+     * @param path Log file path. The file is appended.
+     * @param workers_count Number of rings to create.
+     * @param ring_size Power of 2 number - length of each ring.
+     * @param drain_interval Delay between draining passes.
+     * @throws std::runtime_error if the file can't be opened.
+     * @throws std::invalid_argument if ring_size is bad.
+     */
+    TaskLog(const std::string &path, size_t workers_count, size_t ring_size,
+            std::chrono::milliseconds drain_interval = std::chrono::milliseconds(10));
+
+    /**
+     * @brief ~TaskLog Stop the drainer thread, write remaining records and close the file.
+     * Writers should be stopped before.
+     */
+    ~TaskLog();
+
+    /**
+     * @brief write Write record to the worker's ring.
+     * Should be called only from the thread of the worker with given id.
+     * @param worker Id of the calling worker.
+     * @param format Format string with '{}' placeholders.
+     * @param args Integral, floating point or 'const char *' arguments, at most LogRecord::MaxArgs.
+     * @return false if the record was dropped because the ring is full.
+     */
+    template <typename... Args>
+    bool write(size_t worker, const char *format, Args... args);
+
+    /**
+     * @brief getDroppedCount Returns number of records dropped so far.
+     */
+    size_t getDroppedCount() const;
+
+private:
+    TaskLog(const TaskLog&) = delete;
+    TaskLog & operator=(const TaskLog&) = delete;
+
+    static void setArgs(LogRecord &, size_t) {
+    }
+
+    template <typename Arg, typename... Args>
+    static void setArgs(LogRecord &record, size_t index, Arg arg, Args... args);
+
+    template <typename Arg>
+    static typename std::enable_if<std::is_integral<Arg>::value>::type
+    setArg(LogRecord &record, size_t index, Arg arg);
+    static void setArg(LogRecord &record, size_t index, double arg);
+    static void setArg(LogRecord &record, size_t index, const char *arg);
+
+    /**
+     * @brief drain Format and write all records available now.
+     */
+    void drain();
+    void format(const LogRecord &record);
+    void drainerFunc(std::chrono::milliseconds drain_interval);
+
+    std::FILE *m_file;
+    std::vector<std::unique_ptr<Ring>> m_rings;
+    std::vector<LogRecord> m_batch;
+    std::atomic<size_t> m_dropped;
+    std::atomic<bool> m_running_flag;
+    std::thread m_thread;
+};
+
+
+/// Implementation
+
+inline TaskLog::TaskLog(const std::string &path, size_t workers_count, size_t ring_size,
+                        std::chrono::milliseconds drain_interval)
+    : m_file(std::fopen(path.c_str(), "a"))
+    , m_dropped(0)
+    , m_running_flag(true) {
+    if (!m_file) {
+        throw std::runtime_error("can't open log file " + path);
+    }
+
+    try {
+        m_rings.reserve(workers_count);
+        for (size_t i = 0; i < workers_count; ++i) {
+            m_rings.emplace_back(new Ring(ring_size));
+        }
+    } catch (...) {
+        std::fclose(m_file);
+        throw;
+    }
+
+    m_thread = std::thread(&TaskLog::drainerFunc, this, drain_interval);
+}
+
+inline TaskLog::~TaskLog() {
+    m_running_flag.store(false, std::memory_order_relaxed);
+    m_thread.join();
+    drain();
+    std::fclose(m_file);
+}
+
+inline size_t TaskLog::getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+template <typename Arg>
+inline typename std::enable_if<std::is_integral<Arg>::value>::type
+TaskLog::setArg(LogRecord &record, size_t index, Arg arg) {
+    if (std::is_signed<Arg>::value) {
+        record.types[index] = LogRecord::Int;
+        record.args[index].i = static_cast<int64_t>(arg);
+    } else {
+        record.types[index] = LogRecord::UInt;
+        record.args[index].u = static_cast<uint64_t>(arg);
+    }
+}
+
+inline void TaskLog::setArg(LogRecord &record, size_t index, double arg) {
+    record.types[index] = LogRecord::Double;
+    record.args[index].d = arg;
+}
+
+inline void TaskLog::setArg(LogRecord &record, size_t index, const char *arg) {
+    record.types[index] = LogRecord::String;
+    record.args[index].s = arg;
+}
+
+template <typename Arg, typename... Args>
+inline void TaskLog::setArgs(LogRecord &record, size_t index, Arg arg, Args... args) {
+    setArg(record, index, arg);
+    setArgs(record, index + 1, args...);
+}
+
+template <typename... Args>
+inline bool TaskLog::write(size_t worker, const char *format, Args... args) {
+    static_assert(sizeof...(Args) <= LogRecord::MaxArgs, "too many log arguments");
+
+    LogRecord record;
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    record.format = format;
+    record.worker = static_cast<uint16_t>(worker);
+    record.count = sizeof...(Args);
+    setArgs(record, 0, args...);
+
+    if (!m_rings[worker]->push(record)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+inline void TaskLog::format(const LogRecord &record) {
+    std::fprintf(m_file, "%llu [%u] ", static_cast<unsigned long long>(record.timestamp),
+                 static_cast<unsigned>(record.worker));
+
+    size_t arg = 0;
+    for (const char *p = record.format; *p; ++p) {
+        if (p[0] == '{' && p[1] == '}' && arg < record.count) {
+            const LogRecord::Arg &value = record.args[arg];
+            switch (record.types[arg]) {
+            case LogRecord::Int:
+                std::fprintf(m_file, "%lld", static_cast<long long>(value.i));
+                break;
+            case LogRecord::UInt:
+                std::fprintf(m_file, "%llu", static_cast<unsigned long long>(value.u));
+                break;
+            case LogRecord::Double:
+                std::fprintf(m_file, "%g", value.d);
+                break;
+            case LogRecord::String:
+                std::fputs(value.s ? value.s : "(null)", m_file);
+                break;
+            }
+            ++arg;
+            ++p;
+        } else {
+            std::fputc(*p, m_file);
+        }
+    }
+
+    std::fputc('\n', m_file);
+}
+
+inline void TaskLog::drain() {
+    LogRecord record;
+    for (auto &ring : m_rings) {
+        while (ring->pop(record)) {
+            m_batch.push_back(record);
+        }
+    }
+
+    if (m_batch.empty()) {
+        return;
+    }
+
+    std::stable_sort(m_batch.begin(), m_batch.end(), [](const LogRecord &a, const LogRecord &b) {
+        return a.timestamp < b.timestamp;
+    });
+
+    for (const auto &batch_record : m_batch) {
+        format(batch_record);
+    }
+    m_batch.clear();
+
+    std::fflush(m_file);
+}
+
+inline void TaskLog::drainerFunc(std::chrono::milliseconds drain_interval) {
+    while (m_running_flag.load(std::memory_order_relaxed)) {
+        drain();
+        std::this_thread::sleep_for(drain_interval);
+    }
+}
+
+#endif
@@ -2,12 +2,30 @@
 #define THREAD_POOL_HPP
 
 #include <atomic>
+#include <chrono>
 #include <stdexcept>
 #include <memory>
 #include <vector>
 #include <future>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#define THREAD_POOL_SCHED_PRIORITY 1
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#define THREAD_POOL_THREAD_NICE 1
+#endif
 
 #include "worker.hpp"
+#include "balancing.hpp"
+#include "trace_recorder.hpp"
 
 /**
  * @brief The ThreadPoolOptions struct provides construction options for ThreadPool.
@@ -15,6 +33,25 @@
 struct ThreadPoolOptions {
     size_t threads_count{std::thread::hardware_concurrency()};
     size_t worker_queue_size = 1024;
+    size_t idle_queue_size = 1024;
+    BalancingStrategy balancing = BalancingStrategy::Hybrid;
+    std::string log_path;
+    size_t log_ring_size = 4096;
+    std::string trace_path;
+    bool qsbr = false;
+    bool slab_allocator = false;
+    size_t urgent_threads_count = 0;
+    size_t urgent_queue_size = 256;
+    bool urgent_busy_poll = true;
+    int urgent_fifo_priority = 0;
+    int urgent_nice = 0;
+    bool warm_up = false;
+    size_t warm_up_stack_size = 256 * 1024;
+    size_t preempt_queue_threshold = 0;
+    std::chrono::microseconds preempt_time_slice{0};
+    bool prefetch_lookahead = false;
+    size_t priority_queue_size = 0;
+    size_t priority_heaps_per_worker = 2;
     Worker::OnStart onStart;
     Worker::OnStop onStop;
 };
@@ -23,25 +60,34 @@ struct ThreadPoolOptions {
  * @brief The ThreadPool class implements thread pool pattern.
  * It is highly scalable and fast.
  * It is header only.
- * It implements both work-stealing and work-distribution balancing startegies.
+ * It implements both work-stealing and work-distribution balancing startegies,
+ * see BalancingStrategy.
  * It implements cooperative scheduling strategy for tasks.
  */
 class ThreadPool {
 public:
     /**
      * @brief ThreadPool Construct and start new thread pool.
+     * If ThreadPoolOptions::warm_up is set, it returns only after every worker
+     * pre-faulted its stack and queue and ran a warm-up pass, see Worker::setWarmUp().
      * @param options Creation options.
      */
     explicit ThreadPool(const ThreadPoolOptions &options = ThreadPoolOptions());
 
     /**
      * @brief ~ThreadPool Stop all workers and destroy thread pool.
+     * Running tasks are asked to yield, see WorkerContext::preemptRequested(), and waited for.
+     * Each worker finishes at most one task after the call: the one it is running, or
+     * popped just before it saw the stop. Tasks left in queues are destroyed without running.
      */
     ~ThreadPool();
 
     /**
      * @brief post Post piece of job to thread pool.
-     * @param handler Handler to be called from thread pool worker. It has to be callable as 'handler()'.
+     * @param handler Handler to be called from thread pool worker. It has to be callable as
+     * 'handler(WorkerContext &)' or 'handler(size_t id)'.
+     * With ThreadPoolOptions::prefetch_lookahead set, 'handler.prefetch()' is called if the
+     * handler has it, before the worker runs the task preceding the handler in its queue.
      * @throws std::overflow_error if worker's queue is full.
      * @note All exceptions thrown by handler will be suppressed. Use 'process()' to get result of handler's
      * execution or exception thrown.
@@ -49,56 +95,351 @@ public:
     template <typename Handler>
     void post(Handler &&handler);
 
+    /**
+     * @brief post Post piece of job of the given kind to thread pool.
+     * The tag is stored in the arrival trace if ThreadPoolOptions::trace_path is set.
+     * @param handler Handler to be called from thread pool worker.
+     * @param tag User defined task kind.
+     * @throws std::overflow_error if worker's queue is full.
+     */
+    template <typename Handler>
+    void post(Handler &&handler, uint16_t tag);
+
     /**
      * @brief process Post piece of job to thread pool and get future for this job.
-     * @param handler Handler to be called from thread pool worker. It has to be callable as 'handler()'.
+     * @param handler Handler to be called from thread pool worker. It has to be callable as
+     * 'handler(WorkerContext &)' or 'handler(size_t id)'.
      * @return Future which hold handler result or exception thrown.
      * @throws std::overflow_error if worker's queue is full.
      * @note This method of posting job to thread pool is much slower than 'post()' due to std::future and
      * std::packaged_task construction overhead.
      */
-    template <typename Handler, typename R = typename std::result_of<Handler(size_t)>::type>
+    template <typename Handler, typename R = typename std::result_of<Handler(WorkerContext &)>::type>
     typename std::future<R> process(Handler &&handler);
+
+    /**
+     * @brief postIdle Post piece of background job which uses only otherwise idle CPU.
+     * Idle tasks run when a worker has found neither own nor stolen task, one per idle step,
+     * so they never delay ordinary tasks. A task posted to the worker while it runs an idle
+     * task asks the idle task to yield, see WorkerContext::preemptRequested().
+     * @param handler Handler to be called from thread pool worker.
+     * @throws std::overflow_error if worker's idle queue is full.
+     */
+    template <typename Handler>
+    void postIdle(Handler &&handler);
+
+    /**
+     * @brief postUrgent Post piece of job to the reserved urgent workers.
+     * Urgent workers are created with ThreadPoolOptions::urgent_threads_count and run
+     * nothing but urgent tasks, so these aren't delayed by long tasks of ordinary workers.
+     * If there are no urgent workers the job is posted as with 'post()' and the task
+     * running on the selected worker is asked to yield.
+     * @param handler Handler to be called from thread pool worker.
+     * @throws std::overflow_error if worker's queue is full.
+     */
+    template <typename Handler>
+    void postUrgent(Handler &&handler);
+
+    /**
+     * @brief postPriority Post piece of job with numeric priority.
+     * With ThreadPoolOptions::priority_queue_size set, the job goes to a relaxed priority
+     * queue shared by ordinary workers (see MultiQueue) which has
+     * ThreadPoolOptions::priority_heaps_per_worker heaps per worker. Workers take its
+     * jobs approximately in priority order after their own queues' jobs.
+     * Without it the job is posted as with 'post()' and the priority is ignored.
+     * @param handler Handler to be called from thread pool worker.
+     * @param priority Job priority, lower values run first.
+     * @throws std::overflow_error if the priority queue or worker's queue is full.
+     */
+    template <typename Handler>
+    void postPriority(Handler &&handler, uint64_t priority);
+
+    /**
+     * @brief postIntrusive Post task owned by the caller without copying it.
+     * The task is linked to the intrusive queue of the selected worker, so there is
+     * neither copy to a queue cell nor allocation, and the task size isn't limited.
+     * The task is never stolen: only the selected worker runs it, and only once its ordinary
+     * queue is empty, so a worker kept busy by its queue starves intrusive tasks.
+     * Tasks not run before the thread pool is destroyed are never run.
+     * With tracing enabled, the task is recorded at post time without execution time.
+     * @param task Task which should stay alive until its run() is called.
+     */
+    void postIntrusive(IntrusiveTask &task);
+
+    /**
+     * @brief postBulk Post several tasks to thread pool with one worker selection.
+     * Tasks are placed to the worker selected by the balancing strategy as with 'post()';
+     * if it can't accept all of them the rest goes to the following workers. With tracing enabled, posted tasks are
+     * recorded without execution time since their handlers are already type-erased.
+     * @param tasks Tasks to be moved to thread pool.
+     * @param count Number of tasks.
+     * @return Number of leading tasks posted. It is less than count only if all workers' queues are full.
+     */
+    size_t postBulk(Worker::Task *tasks, size_t count);
     
+    /**
+     * @brief requestPreempt Ask all tasks running now to yield.
+     * The pool also asks the running task of a worker to yield when its queue grows to
+     * ThreadPoolOptions::preempt_queue_threshold tasks, when the task runs longer than
+     * ThreadPoolOptions::preempt_time_slice and when an urgent task has to be posted to
+     * an ordinary worker.
+     * @see WorkerContext::preemptRequested
+     */
+    void requestPreempt();
+
     /**
      * @brief getWorkerCount Returns the number of workers created by the thread pool
-     * @return The worker count
+     * @return The worker count, urgent workers are not counted
      */
     size_t getWorkerCount() const;
 
+    /**
+     * @brief getUrgentWorkerCount Returns the number of reserved urgent workers.
+     * Their IDs follow the IDs of ordinary workers.
+     */
+    size_t getUrgentWorkerCount() const;
+
+    /**
+     * @brief getResidentMemory Returns approximate number of bytes committed by the thread pool.
+     * Worker queues are only reserved on construction and committed page by page as they grow,
+     * so this is usually much less than the size of queues. Thread stacks are not counted.
+     */
+    size_t getResidentMemory() const;
+
+    /**
+     * @brief log Write structured record to the log of the calling worker.
+     * Logging is enabled by ThreadPoolOptions::log_path. The call never blocks: the record
+     * is put to the worker's ring and formatted later by a background thread.
+     * @param format Format string with '{}' placeholders. Should outlive the thread pool.
+     * @param args Integral, floating point or 'const char *' arguments.
+     * @return false if called not from a worker thread, logging is disabled or the ring is full.
+     * @see TaskLog
+     */
+    template <typename... Args>
+    static bool log(const char *format, Args... args);
+
+    /**
+     * @brief getQsbr Returns the reclamation domain whose readers are this pool's workers.
+     * Tasks may read QsbrPtr values of this domain without atomic read-modify-write
+     * operations; the gap between two tasks of a worker is its quiescent state.
+     * The domain exists only if ThreadPoolOptions::qsbr is set, otherwise workers don't
+     * report quiescent states at all.
+     * @throws std::logic_error if ThreadPoolOptions::qsbr is not set.
+     * @see QsbrDomain
+     */
+    QsbrDomain & getQsbr();
+
+    /**
+     * @brief getSlabAllocator Returns the slab allocator with a cache per worker.
+     * Tasks allocate with SlabAllocator::allocate() from the executing worker's cache.
+     * The allocator exists only if ThreadPoolOptions::slab_allocator is set, otherwise
+     * SlabAllocator::allocate() falls back to the global heap in workers too.
+     * @throws std::logic_error if ThreadPoolOptions::slab_allocator is not set.
+     * @see SlabAllocator
+     */
+    SlabAllocator & getSlabAllocator();
+
+    /**
+     * @brief getLogDroppedCount Returns number of log records dropped because worker rings were full.
+     */
+    size_t getLogDroppedCount() const;
+
 private:
     ThreadPool(const ThreadPool&) = delete;
     ThreadPool & operator=(const ThreadPool&) = delete;
 
     Worker & getWorker();
 
+    /**
+     * @brief getWorkerId Returns id of the worker selected for a new task by the balancing strategy.
+     */
+    size_t getWorkerId();
+
+    /**
+     * @brief postTask Post task to the worker's queue, see the overload with push.
+     */
+    template <typename Handler>
+    bool postTask(Worker &worker, Handler &&handler, uint16_t tag);
+
+    /**
+     * @brief postTask Post task through push, wrapping it with TracedTask if tracing is enabled.
+     * Push calls the factory it gets only once a place for the task is claimed, so the
+     * handler is left intact if the queue is full. Handlers too big to be wrapped are
+     * recorded without execution time once posted.
+     * @param push Callable taking a task factory and returning true on success.
+     */
+    template <typename Handler, typename Push>
+    bool postTask(Handler &&handler, uint16_t tag, Push &&push);
+
+    template <typename Handler, typename Push>
+    bool postTraced(Handler &&handler, uint16_t tag, Push &&push, std::true_type fits);
+
+    template <typename Handler, typename Push>
+    bool postTraced(Handler &&handler, uint16_t tag, Push &&push, std::false_type fits);
+
+    /**
+     * @brief recordUntraced Record tasks which can't be wrapped with TracedTask.
+     */
+    void recordUntraced(size_t count, size_t size);
+
+    /**
+     * @brief getLocalWorkerId Returns id of this pool's worker executing the calling thread.
+     * @return Worker id or BalancingPolicy::noWorker.
+     */
+    size_t getLocalWorkerId() const;
+
+    /**
+     * @brief setUrgentPriority Raise scheduling priority of the calling thread.
+     * Best effort: without the required privileges the priority stays unchanged.
+     * @param fifo_priority SCHED_FIFO priority, zero keeps the default policy.
+     * @param nice Nice value applied if fifo_priority is zero, zero keeps it unchanged.
+     * It is applied on Linux only, where a nice value belongs to a thread rather than a process.
+     */
+    static void setUrgentPriority(int fifo_priority, int nice);
+
+    /**
+     * @brief checkPressure Ask the worker's running task to yield if its queue is too long.
+     */
+    void checkPressure(Worker &worker);
+
+    /**
+     * @brief watchdogFunc Watchdog thread function. Asks tasks running longer than
+     * the time slice to yield.
+     */
+    void watchdogFunc(std::chrono::microseconds time_slice);
+
+    const BalancingStrategy m_balancing;
+    std::unique_ptr<TaskLog> m_log;
+    std::unique_ptr<TraceRecorder> m_trace;
+    std::unique_ptr<QsbrDomain> m_qsbr;
+    std::unique_ptr<SlabAllocator> m_slab;
+    std::unique_ptr<MultiQueue<Worker::Task>> m_priority_queue;
     std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::unique_ptr<Worker>> m_urgent_workers;
     std::atomic<size_t> m_next_worker;
+    std::atomic<size_t> m_next_urgent_worker;
+    std::atomic<size_t> m_warming_up;
+    const size_t m_preempt_queue_threshold;
+    std::atomic<bool> m_watchdog_running;
+    std::thread m_watchdog;
 };
 
 
 /// Implementation
 
 inline ThreadPool::ThreadPool(const ThreadPoolOptions &options)
-    : m_next_worker(0) {
+    : m_balancing(options.balancing)
+    , m_next_worker(0)
+    , m_next_urgent_worker(0)
+    , m_warming_up(0)
+    , m_preempt_queue_threshold(options.preempt_queue_threshold)
+    , m_watchdog_running(false) {
     auto workers_count = options.threads_count;
 
     if (0 == workers_count) {
         workers_count = 1;
     }
 
+    const size_t total_count = workers_count + options.urgent_threads_count;
+
+    if (!options.log_path.empty()) {
+        m_log.reset(new TaskLog(options.log_path, total_count, options.log_ring_size));
+    }
+
+    if (!options.trace_path.empty()) {
+        m_trace.reset(new TraceRecorder(options.trace_path));
+    }
+
+    if (options.qsbr) {
+        m_qsbr.reset(new QsbrDomain(total_count));
+    }
+    if (options.slab_allocator) {
+        m_slab.reset(new SlabAllocator(total_count));
+    }
+
+    if (options.priority_queue_size != 0) {
+        m_priority_queue.reset(new MultiQueue<Worker::Task>(
+            workers_count * options.priority_heaps_per_worker, options.priority_queue_size));
+    }
+
     m_workers.reserve(workers_count);
-    for (size_t i = 0; i < workers_count; ++i) {
-        m_workers.emplace_back(new Worker(i, options.worker_queue_size));
+    m_urgent_workers.reserve(options.urgent_threads_count);
+    for (size_t i = 0; i < total_count; ++i) {
+        const bool urgent = i >= workers_count;
+        auto &workers = urgent ? m_urgent_workers : m_workers;
+        if (urgent) {
+            workers.emplace_back(new Worker(i, options.urgent_queue_size));
+        } else {
+            workers.emplace_back(new Worker(i, options.worker_queue_size, options.idle_queue_size));
+        }
+        workers.back()->setLog(m_log.get());
+        workers.back()->setQsbr(m_qsbr.get());
+        workers.back()->setSlabCache(m_slab ? m_slab->getCache(i) : nullptr);
+        workers.back()->setBusyPoll(urgent && options.urgent_busy_poll);
+        workers.back()->setTrackTaskStart(options.preempt_time_slice.count() != 0);
+        workers.back()->setLookahead(!urgent && options.prefetch_lookahead);
+        if (!urgent) {
+            workers.back()->setPriorityQueue(m_priority_queue.get());
+        }
+        if (options.warm_up) {
+            workers.back()->setWarmUp(options.warm_up_stack_size, &m_warming_up);
+        }
+    }
+
+    if (options.warm_up) {
+        m_warming_up.store(total_count, std::memory_order_relaxed);
     }
 
     for (size_t i = 0; i < m_workers.size(); ++i) {
-        Worker *steal_donor = m_workers[(i + 1) % m_workers.size()].get();
-        m_workers[i]->start(steal_donor, options.onStart, options.onStop);
+        std::vector<Worker *> steal_donors;
+        for (size_t id : BalancingPolicy::stealDonors(m_balancing, i, m_workers.size())) {
+            steal_donors.push_back(m_workers[id].get());
+        }
+        m_workers[i]->start(std::move(steal_donors), options.onStart, options.onStop);
+    }
+
+    // Urgent workers steal only from each other, so they never pick up ordinary tasks.
+    auto onUrgentStart = [options](size_t id) {
+        setUrgentPriority(options.urgent_fifo_priority, options.urgent_nice);
+        if (options.onStart) {
+            options.onStart(id);
+        }
+    };
+    for (size_t i = 0; i < m_urgent_workers.size(); ++i) {
+        std::vector<Worker *> steal_donors;
+        for (size_t id : BalancingPolicy::stealDonors(BalancingStrategy::WorkStealing, i, m_urgent_workers.size())) {
+            steal_donors.push_back(m_urgent_workers[id].get());
+        }
+        m_urgent_workers[i]->start(std::move(steal_donors), onUrgentStart, options.onStop);
+    }
+
+    while (m_warming_up.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+
+    if (options.preempt_time_slice.count() != 0) {
+        m_watchdog_running.store(true, std::memory_order_relaxed);
+        m_watchdog = std::thread(&ThreadPool::watchdogFunc, this, options.preempt_time_slice);
     }
 }
 
 inline ThreadPool::~ThreadPool() {
+    if (m_watchdog.joinable()) {
+        m_watchdog_running.store(false, std::memory_order_relaxed);
+        m_watchdog.join();
+    }
+
+    // All workers are asked to stop before joining any, so a task started on one
+    // worker while another is joined still sees the preempt request.
+    for (auto &worker_ptr : m_urgent_workers) {
+        worker_ptr->requestStop();
+    }
+    for (auto &worker_ptr : m_workers) {
+        worker_ptr->requestStop();
+    }
+    for (auto &worker_ptr : m_urgent_workers) {
+        worker_ptr->stop();
+    }
     for (auto &worker_ptr : m_workers) {
         worker_ptr->stop();
     }
@@ -106,34 +447,267 @@ inline ThreadPool::~ThreadPool() {
 
 template <typename Handler>
 inline void ThreadPool::post(Handler &&handler) {
-    if (!getWorker().post(std::forward<Handler>(handler))) {
+    post(std::forward<Handler>(handler), 0);
+}
+
+template <typename Handler>
+inline void ThreadPool::post(Handler &&handler, uint16_t tag) {
+    Worker &worker = getWorker();
+    if (!postTask(worker, std::forward<Handler>(handler), tag)) {
         throw std::overflow_error("worker queue is full");
     }
+    checkPressure(worker);
 }
 
 template <typename Handler, typename R>
 typename std::future<R> ThreadPool::process(Handler &&handler) {
-    std::packaged_task<R(size_t)> task([handler = std::move(handler)] (size_t id) {
-        return handler(id);
+    std::packaged_task<R(WorkerContext &)> task([handler = std::move(handler)] (WorkerContext &context) {
+        return handler(context);
     });
 
     auto result = task.get_future();
 
-    if (!getWorker().post(task)) {
+    Worker &worker = getWorker();
+    if (!postTask(worker, task, 0)) {
         throw std::overflow_error("worker queue is full");
     }
+    checkPressure(worker);
 
     return result;
 }
 
+template <typename Handler>
+inline void ThreadPool::postIdle(Handler &&handler) {
+    size_t id = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    Worker &worker = *m_workers[id];
+    if (!postTask(std::forward<Handler>(handler), 0,
+                  [&worker](auto &&make) { return worker.postIdleConstructed(make); })) {
+        throw std::overflow_error("worker idle queue is full");
+    }
+}
+
+template <typename Handler>
+inline void ThreadPool::postUrgent(Handler &&handler) {
+    if (m_urgent_workers.empty()) {
+        Worker &worker = getWorker();
+        if (!postTask(worker, std::forward<Handler>(handler), 0)) {
+            throw std::overflow_error("worker queue is full");
+        }
+        worker.requestPreempt();
+        return;
+    }
+
+    size_t id = m_next_urgent_worker.fetch_add(1, std::memory_order_relaxed) % m_urgent_workers.size();
+    if (!postTask(*m_urgent_workers[id], std::forward<Handler>(handler), 0)) {
+        throw std::overflow_error("worker queue is full");
+    }
+}
+
+template <typename Handler>
+inline bool ThreadPool::postTask(Worker &worker, Handler &&handler, uint16_t tag) {
+    return postTask(std::forward<Handler>(handler), tag,
+                    [&worker](auto &&make) { return worker.postConstructed(make); });
+}
+
+template <typename Handler, typename Push>
+inline bool ThreadPool::postTask(Handler &&handler, uint16_t tag, Push &&push) {
+    if (!m_trace) {
+        return push([&handler]() -> Handler && { return std::forward<Handler>(handler); });
+    }
+
+    typedef TracedTask<typename std::decay<Handler>::type> Traced;
+    return postTraced(std::forward<Handler>(handler), tag, std::forward<Push>(push),
+        std::integral_constant<bool, sizeof(Traced) < Worker::TaskStorageSize>());
+}
+
+template <typename Handler, typename Push>
+inline bool ThreadPool::postTraced(Handler &&handler, uint16_t tag, Push &&push, std::true_type) {
+    typedef typename std::decay<Handler>::type HandlerType;
+    const uint64_t post_time = m_trace->now();
+    return push([&]() {
+        return TracedTask<HandlerType>{std::move(handler), m_trace.get(), post_time,
+                                       TraceRecorder::sizeClass(sizeof(HandlerType)), tag};
+    });
+}
+
+template <typename Handler, typename Push>
+inline bool ThreadPool::postTraced(Handler &&handler, uint16_t tag, Push &&push, std::false_type) {
+    typedef typename std::decay<Handler>::type HandlerType;
+    const uint64_t post_time = m_trace->now();
+    if (!push([&handler]() -> Handler && { return std::forward<Handler>(handler); })) {
+        return false;
+    }
+    m_trace->record(TraceRecord{post_time, TraceRecord::Unmeasured,
+                                TraceRecorder::sizeClass(sizeof(HandlerType)), tag});
+    return true;
+}
+
+inline void ThreadPool::recordUntraced(size_t count, size_t size) {
+    const uint64_t post_time = m_trace->now();
+    for (size_t i = 0; i < count; ++i) {
+        m_trace->record(TraceRecord{post_time, TraceRecord::Unmeasured, TraceRecorder::sizeClass(size), 0});
+    }
+}
+
+template <typename Handler>
+inline void ThreadPool::postPriority(Handler &&handler, uint64_t priority) {
+    if (!m_priority_queue) {
+        post(std::forward<Handler>(handler));
+        return;
+    }
+
+    if (!postTask(std::forward<Handler>(handler), 0, [this, priority](auto &&make) {
+            return m_priority_queue->pushConstructed(priority, make);
+        })) {
+        throw std::overflow_error("priority queue is full");
+    }
+}
+
+inline void ThreadPool::postIntrusive(IntrusiveTask &task) {
+    getWorker().postIntrusive(task);
+    if (m_trace) {
+        recordUntraced(1, sizeof(IntrusiveTask));
+    }
+}
+
+inline size_t ThreadPool::postBulk(Worker::Task *tasks, size_t count) {
+    size_t id = getWorkerId();
+
+    size_t posted = 0;
+    for (size_t i = 0; i < m_workers.size() && posted < count; ++i) {
+        Worker &worker = *m_workers[(id + i) % m_workers.size()];
+        size_t accepted = worker.postBulk(tasks + posted, count - posted);
+        if (accepted != 0) {
+            posted += accepted;
+            checkPressure(worker);
+        }
+    }
+
+    if (m_trace) {
+        recordUntraced(posted, sizeof(Worker::Task));
+    }
+
+    return posted;
+}
 
 inline Worker & ThreadPool::getWorker() {
-    auto id = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
-    return *m_workers[id];
+    return *m_workers[getWorkerId()];
+}
+
+inline size_t ThreadPool::getWorkerId() {
+    size_t local = m_balancing == BalancingStrategy::WorkStealing ? getLocalWorkerId() : BalancingPolicy::noWorker;
+
+    return BalancingPolicy::place(m_balancing, m_workers.size(), local,
+        [this]() { return m_next_worker.fetch_add(1, std::memory_order_relaxed); },
+        [this](size_t id) { return m_workers[id]->getQueueSize(); });
+}
+
+inline size_t ThreadPool::getLocalWorkerId() const {
+    Worker *worker = Worker::current();
+    if (worker && worker->getId() < m_workers.size() && m_workers[worker->getId()].get() == worker) {
+        return worker->getId();
+    }
+    return BalancingPolicy::noWorker;
 }
 
 inline size_t ThreadPool::getWorkerCount() const {
     return m_workers.size();
 }
 
+inline void ThreadPool::requestPreempt() {
+    for (auto &worker : m_workers) {
+        worker->requestPreempt();
+    }
+    for (auto &worker : m_urgent_workers) {
+        worker->requestPreempt();
+    }
+}
+
+inline void ThreadPool::checkPressure(Worker &worker) {
+    if (m_preempt_queue_threshold != 0 && worker.getQueueSize() >= m_preempt_queue_threshold) {
+        worker.requestPreempt();
+    }
+}
+
+inline void ThreadPool::watchdogFunc(std::chrono::microseconds time_slice) {
+    const uint64_t slice = std::chrono::duration_cast<std::chrono::nanoseconds>(time_slice).count();
+
+    while (m_watchdog_running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(time_slice / 2);
+
+        const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        for (auto &worker : m_workers) {
+            uint64_t started = worker->getTaskStartTime();
+            if (started != 0 && now > started + slice) {
+                worker->requestPreempt();
+            }
+        }
+    }
+}
+
+inline size_t ThreadPool::getUrgentWorkerCount() const {
+    return m_urgent_workers.size();
+}
+
+inline void ThreadPool::setUrgentPriority(int fifo_priority, int nice) {
+#ifdef THREAD_POOL_SCHED_PRIORITY
+    if (fifo_priority > 0) {
+        sched_param param;
+        param.sched_priority = fifo_priority;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        return;
+    }
+#else
+    (void)fifo_priority;
+#endif
+
+#ifdef THREAD_POOL_THREAD_NICE
+    if (nice != 0) {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice);
+    }
+#else
+    (void)nice;
+#endif
+}
+
+template <typename... Args>
+inline bool ThreadPool::log(const char *format, Args... args) {
+    Worker *worker = Worker::current();
+    return worker && worker->log(format, args...);
+}
+
+inline QsbrDomain & ThreadPool::getQsbr() {
+    if (!m_qsbr) {
+        throw std::logic_error("qsbr is not enabled in thread pool options");
+    }
+    return *m_qsbr;
+}
+
+inline SlabAllocator & ThreadPool::getSlabAllocator() {
+    if (!m_slab) {
+        throw std::logic_error("slab allocator is not enabled in thread pool options");
+    }
+    return *m_slab;
+}
+
+inline size_t ThreadPool::getLogDroppedCount() const {
+    return m_log ? m_log->getDroppedCount() : 0;
+}
+
+inline size_t ThreadPool::getResidentMemory() const {
+    size_t bytes = sizeof(*this) + m_workers.capacity() * sizeof(m_workers[0])
+        + m_urgent_workers.capacity() * sizeof(m_urgent_workers[0]);
+    if (m_priority_queue) {
+        bytes += m_priority_queue->getResidentMemory();
+    }
+    for (const auto &worker : m_workers) {
+        bytes += worker->getResidentMemory();
+    }
+    for (const auto &worker : m_urgent_workers) {
+        bytes += worker->getResidentMemory();
+    }
+    return bytes;
+}
+
 #endif
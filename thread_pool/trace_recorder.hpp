@@ -0,0 +1,196 @@
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <fixed_function.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The TraceRecord struct describes one task posted to thread pool.
+ * Trace file is the 8 bytes signature followed by records in native byte order.
+ */
+struct TraceRecord {
+    static const uint32_t Unmeasured = ~uint32_t(0);
+
+    uint64_t post_time;  ///< Nanoseconds since the recorder was created.
+    uint32_t duration;   ///< Execution time in nanoseconds or Unmeasured.
+    uint16_t size_class; ///< Log2 of the handler size rounded up.
+    uint16_t tag;        ///< User defined task kind.
+};
+
+/**
+ * @brief The TraceRecorder class writes task arrival traces to a compact binary file.
+ * Records are buffered and written under a mutex, so recording is meant for
+ * capturing traffic shape rather than for always-on use.
+ */
+class TraceRecorder {
+public:
+    /**
+     * @brief TraceRecorder Create trace file.
+     * @param path Trace file path. Existing file is truncated.
+     * @throws std::runtime_error if the file can't be created.
+     */
+    explicit TraceRecorder(const std::string &path);
+
+    /**
+     * @brief ~TraceRecorder Write buffered records and close the file.
+     */
+    ~TraceRecorder();
+
+    /**
+     * @brief now Returns nanoseconds since the recorder was created.
+     */
+    uint64_t now() const;
+
+    /**
+     * @brief record Add record to the trace. Thread safe.
+     */
+    void record(const TraceRecord &record);
+
+    /**
+     * @brief sizeClass Returns size class of a handler.
+     * @param size Handler size in bytes.
+     */
+    static uint16_t sizeClass(size_t size);
+
+    /**
+     * @brief load Read all records of a trace file.
+     * @param path Trace file path.
+     * @return Records in the order they were written.
+     * @throws std::runtime_error if the file can't be read or isn't a trace.
+     */
+    static std::vector<TraceRecord> load(const std::string &path);
+
+private:
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder & operator=(const TraceRecorder&) = delete;
+
+    static const char *signature() {
+        return "TPTRACE1";
+    }
+
+    static const size_t BufferSize = 4096;
+
+    void flush();
+
+    const std::chrono::steady_clock::time_point m_start;
+    std::FILE *m_file;
+    std::mutex m_mutex;
+    std::vector<TraceRecord> m_buffer;
+};
+
+/**
+ * @brief The TracedTask class wraps a task and records its execution time.
+ */
+template <typename Handler>
+struct TracedTask {
+    Handler handler;
+    TraceRecorder *recorder;
+    uint64_t post_time;
+    uint16_t size_class;
+    uint16_t tag;
+
+    template <typename Context>
+    void operator()(Context &context);
+
+    void prefetch();
+};
+
+
+/// Implementation
+
+inline TraceRecorder::TraceRecorder(const std::string &path)
+    : m_start(std::chrono::steady_clock::now())
+    , m_file(std::fopen(path.c_str(), "wb")) {
+    if (!m_file) {
+        throw std::runtime_error("can't create trace file " + path);
+    }
+    std::fwrite(signature(), 1, std::strlen(signature()), m_file);
+    m_buffer.reserve(BufferSize);
+}
+
+inline TraceRecorder::~TraceRecorder() {
+    flush();
+    std::fclose(m_file);
+}
+
+inline uint64_t TraceRecorder::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+}
+
+inline void TraceRecorder::record(const TraceRecord &record) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.push_back(record);
+    if (m_buffer.size() >= BufferSize) {
+        flush();
+    }
+}
+
+inline void TraceRecorder::flush() {
+    if (!m_buffer.empty()) {
+        std::fwrite(m_buffer.data(), sizeof(TraceRecord), m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+}
+
+inline uint16_t TraceRecorder::sizeClass(size_t size) {
+    uint16_t size_class = 0;
+    while ((size_t(1) << size_class) < size) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+inline std::vector<TraceRecord> TraceRecorder::load(const std::string &path) {
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("can't open trace file " + path);
+    }
+
+    char header[8];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header)
+        || 0 != std::memcmp(header, signature(), sizeof(header))) {
+        std::fclose(file);
+        throw std::runtime_error("not a trace file " + path);
+    }
+
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        records.push_back(record);
+    }
+
+    std::fclose(file);
+    return records;
+}
+
+template <typename Handler>
+template <typename Context>
+inline void TracedTask<Handler>::operator()(Context &context) {
+    struct Record {
+        TracedTask &task;
+        uint64_t start;
+        ~Record() {
+            uint64_t duration = task.recorder->now() - start;
+            task.recorder->record(TraceRecord{task.post_time,
+                uint32_t(duration < TraceRecord::Unmeasured ? duration : TraceRecord::Unmeasured - 1),
+                task.size_class, task.tag});
+        }
+    } record{*this, recorder->now()};
+
+    handler(context);
+}
+
+template <typename Handler>
+inline void TracedTask<Handler>::prefetch() {
+    prefetchObject(handler);
+}
+
+#endif
@@ -1,20 +1,155 @@
 #ifndef WORKER_HPP
 #define WORKER_HPP
 
+#include <balancing.hpp>
 #include <fixed_function.hpp>
+#include <graveyard.hpp>
+#include <intrusive_queue.hpp>
 #include <mpsc_bounded_queue.hpp>
+#include <multi_queue.hpp>
+#include <task_log.hpp>
+#include <qsbr.hpp>
+#include <slab_allocator.hpp>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <alloca.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+class Worker;
+
+/**
+ * @brief The WorkerContext class gives a task direct access to facilities of the worker
+ * executing it. Tasks receive it as the 'handler(WorkerContext &)' argument.
+ * It converts to the worker ID, so tasks callable as 'handler(size_t id)' are still
+ * accepted and get the ID without any extra cost.
+ * The context is a handle of the worker and is valid while the worker exists.
+ */
+class WorkerContext {
+public:
+    /**
+     * @brief WorkerContext Constructor.
+     * @param worker Worker the context belongs to.
+     * @param id Worker ID.
+     */
+    WorkerContext(Worker &worker, size_t id);
+
+    /**
+     * @brief operator size_t Returns the worker ID.
+     */
+    operator size_t() const;
+
+    /**
+     * @brief requestPreempt Ask the task running now to yield.
+     * @see WorkerContext::preemptRequested
+     */
+    void requestPreempt();
+
+    /**
+     * @brief getTaskStartTime Returns steady clock time in nanoseconds the running task
+     * started at, or zero if the worker is idle or doesn't track task start.
+     */
+    uint64_t getTaskStartTime() const;
+
+    /**
+     * @brief getId Returns the worker ID.
+     */
+    size_t getId() const;
+
+    /**
+     * @brief post Post task to the worker's own queue bypassing the worker selection.
+     * @param handler Handler to be executed in executing thread.
+     * @return true on success, false if the queue is full.
+     */
+    template <typename Handler>
+    bool post(Handler &&handler);
+
+    /**
+     * @brief log Write record to the worker's log ring.
+     * @see Worker::log
+     */
+    template <typename... Args>
+    bool log(const char *format, Args... args);
+
+    /**
+     * @brief random Returns next number of the worker's pseudo-random sequence.
+     * Should be called from the executing thread.
+     */
+    uint64_t random();
+
+    /**
+     * @brief getTaskCount Returns number of tasks executed by the worker.
+     */
+    size_t getTaskCount() const;
+
+    /**
+     * @brief preemptRequested Returns true if the pool asked the running task to yield.
+     * Long tasks should poll it and, when set, save their progress and repost the rest
+     * with post(), so queued tasks and shutdown aren't delayed. The flag is cleared
+     * before each task starts, but it stays set once the worker is stopping.
+     * The check is two relaxed loads.
+     */
+    bool preemptRequested() const;
+
+    /**
+     * @brief userData Returns per-worker slot for user defined data, nullptr initially.
+     * Should be accessed from the executing thread.
+     */
+    void *& userData();
+
+private:
+    Worker *m_worker;
+    size_t m_id;
+};
+
+/**
+ * @brief The IntrusiveTask class is the base of tasks posted with ThreadPool::postIntrusive().
+ * The queue hook is embedded in the task, so posting links the caller's object into the
+ * worker's IntrusiveMpscQueue without copying or allocating it, and the task size isn't
+ * limited by Worker::TaskStorageSize. The caller owns the task and should keep it alive
+ * until run() is called. The task may be posted again once run() has started.
+ */
+class IntrusiveTask : public IntrusiveNode {
+public:
+    virtual ~IntrusiveTask() = default;
+
+    /**
+     * @brief run Execute the task in the worker thread.
+     */
+    virtual void run(WorkerContext &context) = 0;
+
+    /**
+     * @brief prefetch Called in lookahead mode while the preceding task runs.
+     * @see Worker::setLookahead
+     */
+    virtual void prefetch() {}
+};
 
 /**
  * @brief The Worker class owns task queue and executing thread.
- * In executing thread it tries to pop task from queue. If queue is empty
- * then it tries to steal task from the sibling worker. If stealing was unsuccessful
- * then spins with one millisecond delay.
+ * In executing thread it tries to pop task from queue and then from the queue
+ * of intrusive tasks. If both are empty then it tries to pop task from the shared
+ * priority queue, if there is one, and then to steal task from the sibling workers. If stealing was unsuccessful
+ * then it runs one idle task if there is any, or destroys a batch of objects deferred
+ * to its Graveyard (also done between tasks when the graveyard is overloaded). Otherwise it spins with one millisecond delay, or without delay
+ * in busy-poll mode.
  */
 class Worker {
 public:
-    typedef FixedFunction<void(size_t id), 128> Task;
+    static const size_t TaskStorageSize = 128;
+    typedef FixedFunction<void(WorkerContext &context), TaskStorageSize> Task;
     
     using OnStart = std::function<void(size_t id)>;
     using OnStop = std::function<void(size_t id)>;
@@ -23,16 +158,23 @@ public:
      * @brief Worker Constructor.
      * @param id Worker ID.
      * @param queue_size Length of undelaying task queue.
+     * @param idle_queue_size Length of idle task queue.
      */
-    explicit Worker(size_t id, size_t queue_size);
+    explicit Worker(size_t id, size_t queue_size, size_t idle_queue_size = 2);
 
     /**
      * @brief start Create the executing thread and start tasks execution.
-     * @param steal_donor Sibling worker to steal task from it.
+     * @param steal_donors Sibling workers to steal task from them.
      * @param onStart A handler which is executed when each thread pool thread starts
      * @param onStop A handler which is executed when each thread pool thread stops
      */
-    void start(Worker *steal_donor, OnStart onStart, OnStop onStop);
+    void start(std::vector<Worker *> steal_donors, OnStart onStart, OnStop onStop);
+
+    /**
+     * @brief requestStop Ask the executing thread to finish without waiting for it.
+     * From now on the running and following tasks see WorkerContext::preemptRequested().
+     */
+    void requestStop();
 
     /**
      * @brief stop Stop all worker's thread and stealing activity.
@@ -48,6 +190,47 @@ public:
     template <typename Handler>
     bool post(Handler &&handler);
 
+    /**
+     * @brief postIdle Post task to the idle queue. Idle tasks run only when the worker
+     * found neither own nor stolen task, one per idle step.
+     * @param handler Handler to be executed in executing thread.
+     * @return true on success.
+     */
+    template <typename Handler>
+    bool postIdle(Handler &&handler);
+
+    /**
+     * @brief postConstructed Post task constructed by factory once a queue cell is claimed.
+     * @param make Callable returning the task or a handler, not called if queue is full.
+     * @return true on success.
+     */
+    template <typename Factory>
+    bool postConstructed(Factory &&make);
+
+    /**
+     * @brief postIdleConstructed Post task constructed by factory to the idle queue.
+     * @param make Callable returning the task or a handler, not called if queue is full.
+     * @return true on success.
+     */
+    template <typename Factory>
+    bool postIdleConstructed(Factory &&make);
+
+    /**
+     * @brief postIntrusive Link intrusive task to the worker's intrusive queue.
+     * Intrusive tasks are run by this worker only, they are never stolen, and only once its
+     * own queue is empty, so a worker kept busy by its queue starves them.
+     * @param task Task which is not queued, see IntrusiveTask.
+     */
+    void postIntrusive(IntrusiveTask &task);
+
+    /**
+     * @brief postBulk Post several tasks to queue at once.
+     * @param tasks Tasks to be moved to queue.
+     * @param count Number of tasks.
+     * @return Number of leading tasks posted.
+     */
+    size_t postBulk(Task *tasks, size_t count);
+
     /**
      * @brief steal Steal one task from this worker queue.
      * @param task Place for stealed task to be stored.
@@ -55,20 +238,201 @@ public:
      */
     bool steal(Task &task);
 
+    /**
+     * @brief setLog Set log the worker writes records to. Should be called before start().
+     * @param log Task log or nullptr to disable logging.
+     */
+    void setLog(TaskLog *log);
+
+    /**
+     * @brief setQsbr Set reclamation domain the worker reports quiescent states to.
+     * The worker uses its ID as reader slot. Should be called before start().
+     * @param qsbr Reclamation domain or nullptr.
+     */
+    void setQsbr(QsbrDomain *qsbr);
+
+    /**
+     * @brief setBusyPoll Make idle worker poll queues continuously instead of sleeping.
+     * It cuts dispatch latency to the queue access time at the cost of a busy core.
+     * Should be called before start().
+     */
+    void setBusyPoll(bool busy_poll);
+
+    /**
+     * @brief setTrackTaskStart Make the worker store start time of the running task.
+     * Costs one clock read per task. Should be called before start().
+     * @see getTaskStartTime
+     */
+    void setTrackTaskStart(bool track);
+
+    /**
+     * @brief setLookahead Make the worker pop the next task of its own, intrusive or priority
+     * queue before running the current one and call its prefetch(), see FixedFunction::prefetch()
+     * and IntrusiveTask::prefetch().
+     * The popped task can't be stolen until the current one finishes, so the current task
+     * shouldn't block waiting for it. Should be called before start().
+     */
+    void setLookahead(bool lookahead);
+
+    /**
+     * @brief setWarmUp Make the executing thread warm itself up before running tasks.
+     * It pre-faults stack_bytes of its stack and its queue buffer, initializes thread locals,
+     * fills slab cache chunks and runs an empty task. Then it decrements pending and waits
+     * until it is zero, so no worker steals before all of them are warm.
+     * Should be called before start().
+     * @param stack_bytes Number of stack bytes to pre-fault. Clamped to the free part of the
+     * thread's stack where its size is known.
+     * @param pending Counter of workers still warming up, should outlive the worker.
+     */
+    void setWarmUp(size_t stack_bytes, std::atomic<size_t> *pending);
+
+    /**
+     * @brief setPriorityQueue Set priority queue shared by workers. Its tasks are taken
+     * after the worker's own tasks and before stealing. Should be called before start().
+     * @param queue Priority queue or nullptr.
+     */
+    void setPriorityQueue(MultiQueue<Task> *queue);
+
+    /**
+     * @brief setSlabCache Set slab allocator cache of the worker. Should be called before start().
+     * @param cache Slab cache or nullptr.
+     */
+    void setSlabCache(SlabCache *cache);
+
+    /**
+     * @brief log Write record to the worker's log ring. Should be called from the executing thread.
+     * @param format Format string with '{}' placeholders.
+     * @param args Log record arguments.
+     * @return false if logging is disabled or the record was dropped.
+     * @see TaskLog::write
+     */
+    template <typename... Args>
+    bool log(const char *format, Args... args);
+
+    /**
+     * @brief requestPreempt Ask the task running now to yield.
+     * @see WorkerContext::preemptRequested
+     */
+    void requestPreempt();
+
+    /**
+     * @brief getTaskStartTime Returns steady clock time in nanoseconds the running task
+     * started at, or zero if the worker is idle or doesn't track task start.
+     */
+    uint64_t getTaskStartTime() const;
+
+    /**
+     * @brief getId Returns the worker ID.
+     */
+    size_t getId() const;
+
+    /**
+     * @brief getQueueSize Returns approximate number of tasks in worker's queue.
+     */
+    size_t getQueueSize() const;
+
+    /**
+     * @brief getResidentMemory Returns approximate number of bytes committed by the worker.
+     */
+    size_t getResidentMemory() const;
+
+    /**
+     * @brief current Returns the worker executing the calling thread.
+     * @return Worker pointer or nullptr if called not from a worker thread.
+     */
+    static Worker * current();
+
 private:
+    friend class WorkerContext;
+
     Worker(const Worker&) = delete;
     Worker & operator=(const Worker&) = delete;
 
     /**
      * @brief threadFunc Executing thread function.
-     * @param steal_donor Sibling worker to steal task from it.
      * @param onStart A handler which is executed when each thread pool thread starts
      * @param onStop A handler which is executed when each thread pool thread stops
      */
-    void threadFunc(Worker *steal_donor, OnStart onStart, OnStop onStop);
+    void threadFunc(OnStart onStart, OnStop onStop);
+
+    /**
+     * @brief stealFromDonors Try to steal task from sibling workers.
+     * Donors are visited starting from the rotating position to spread contention.
+     * @param task Place for stealed task to be stored.
+     * @return true on success.
+     */
+    bool stealFromDonors(Task &task);
+
+    /**
+     * @brief popTask Take the lookahead task, or pop task from own, intrusive or priority queue
+     * or steal it.
+     * In lookahead mode pops the following task from the same queues but donors and prefetches it.
+     * @param task Place for the task to be stored.
+     * @return true on success.
+     */
+    bool popTask(Task &task);
+
+    /**
+     * @brief popIntrusive Pop intrusive task and wrap its pointer to task.
+     */
+    bool popIntrusive(Task &task);
+
+    /**
+     * @brief stealIdleFromDonors Try to steal idle task from sibling workers.
+     */
+    bool stealIdleFromDonors(Task &task);
+
+    /**
+     * @brief runTask Run task and update task statistics.
+     * @param idle true if the task is from an idle queue.
+     */
+    void runTask(Task &task, bool idle);
+
+    /**
+     * @brief notifyPosted Ask the running idle task to yield for the posted task.
+     */
+    void notifyPosted();
+
+    /**
+     * @brief warmUp Warm the executing thread up, see setWarmUp().
+     */
+    void warmUp();
+
+    static void prefaultStack(size_t bytes);
+
+    /**
+     * @brief getFreeStack Returns stack bytes of the calling thread below the caller's frame,
+     * less a margin for the frames above it, or SIZE_MAX if the stack size is unknown.
+     */
+    static size_t getFreeStack();
+
+    static Worker *& currentRef();
 
     const int _id;
     MPMCBoundedQueue<Task> m_queue;
+    MPMCBoundedQueue<Task> m_idle_queue;
+    IntrusiveMpscQueue m_intrusive_queue;
+    std::vector<Worker *> m_steal_donors;
+    size_t m_steal_cursor;
+    TaskLog *m_log;
+    QsbrDomain *m_qsbr;
+    SlabCache *m_slab_cache;
+    MultiQueue<Task> *m_priority_queue;
+    Graveyard m_graveyard;
+    bool m_busy_poll;
+    size_t m_warm_up_stack_bytes;
+    std::atomic<size_t> *m_warm_up_pending;
+    WorkerContext m_context;
+    uint64_t m_random_state;
+    std::atomic<size_t> m_task_count;
+    bool m_track_task_start;
+    bool m_lookahead;
+    bool m_has_lookahead_task;
+    Task m_lookahead_task;
+    std::atomic<uint64_t> m_task_start;
+    std::atomic<bool> m_preempt_requested;
+    std::atomic<bool> m_running_idle;
+    void *m_user_data;
     std::atomic<bool> m_running_flag;
     std::thread m_thread;
 };
@@ -76,46 +440,398 @@ private:
 
 /// Implementation
 
-inline Worker::Worker(size_t id, size_t queue_size)
+inline Worker::Worker(size_t id, size_t queue_size, size_t idle_queue_size)
     : _id(id), m_queue(queue_size)
+    , m_idle_queue(idle_queue_size)
+    , m_steal_cursor(0)
+    , m_log(nullptr)
+    , m_qsbr(nullptr)
+    , m_slab_cache(nullptr)
+    , m_priority_queue(nullptr)
+    , m_busy_poll(false)
+    , m_warm_up_stack_bytes(0)
+    , m_warm_up_pending(nullptr)
+    , m_context(*this, id)
+    , m_random_state(0x9e3779b97f4a7c15ull * (id + 1))
+    , m_task_count(0)
+    , m_track_task_start(false)
+    , m_lookahead(false)
+    , m_has_lookahead_task(false)
+    , m_task_start(0)
+    , m_preempt_requested(false)
+    , m_running_idle(false)
+    , m_user_data(nullptr)
     , m_running_flag(true) {
 }
 
-inline void Worker::stop() {
+inline void Worker::requestStop() {
     m_running_flag.store(false, std::memory_order_relaxed);
+}
+
+inline void Worker::stop() {
+    requestStop();
     m_thread.join();
 }
 
-inline void Worker::start(Worker *steal_donor, OnStart onStart, OnStop onStop) {
-    m_thread = std::thread(&Worker::threadFunc, this, steal_donor, onStart, onStop);
+inline void Worker::start(std::vector<Worker *> steal_donors, OnStart onStart, OnStop onStop) {
+    m_steal_donors = std::move(steal_donors);
+    m_thread = std::thread(&Worker::threadFunc, this, onStart, onStop);
 }
 
 template <typename Handler>
 inline bool Worker::post(Handler &&handler) {
-    return m_queue.push(std::forward<Handler>(handler));
+    return postConstructed([&handler]() -> Handler && { return std::forward<Handler>(handler); });
+}
+
+template <typename Handler>
+inline bool Worker::postIdle(Handler &&handler) {
+    return m_idle_queue.push(std::forward<Handler>(handler));
+}
+
+template <typename Factory>
+inline bool Worker::postConstructed(Factory &&make) {
+    if (!m_queue.pushConstructed(std::forward<Factory>(make))) {
+        return false;
+    }
+    notifyPosted();
+    return true;
+}
+
+template <typename Factory>
+inline bool Worker::postIdleConstructed(Factory &&make) {
+    return m_idle_queue.pushConstructed(std::forward<Factory>(make));
+}
+
+inline void Worker::postIntrusive(IntrusiveTask &task) {
+    m_intrusive_queue.push(&task);
+    notifyPosted();
+}
+
+inline size_t Worker::postBulk(Task *tasks, size_t count) {
+    size_t posted = m_queue.pushBulk(tasks, count);
+    if (posted != 0) {
+        notifyPosted();
+    }
+    return posted;
+}
+
+inline void Worker::notifyPosted() {
+    // Pairs with the fence in runTask(): either this load sees the idle task
+    // or the worker's queue check after its store sees the posted task.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_running_idle.load(std::memory_order_relaxed)) {
+        requestPreempt();
+    }
 }
 
 inline bool Worker::steal(Task &task) {
     return m_queue.pop(task);
 }
 
-inline void Worker::threadFunc(Worker *steal_donor, OnStart onStart, OnStop onStop) {   
+inline void Worker::setLog(TaskLog *log) {
+    m_log = log;
+}
+
+inline void Worker::setQsbr(QsbrDomain *qsbr) {
+    m_qsbr = qsbr;
+}
+
+inline void Worker::setBusyPoll(bool busy_poll) {
+    m_busy_poll = busy_poll;
+}
+
+inline void Worker::setTrackTaskStart(bool track) {
+    m_track_task_start = track;
+}
+
+inline void Worker::setLookahead(bool lookahead) {
+    m_lookahead = lookahead;
+}
+
+inline void Worker::requestPreempt() {
+    m_preempt_requested.store(true, std::memory_order_relaxed);
+}
+
+inline uint64_t Worker::getTaskStartTime() const {
+    return m_task_start.load(std::memory_order_relaxed);
+}
+
+inline void Worker::setWarmUp(size_t stack_bytes, std::atomic<size_t> *pending) {
+    m_warm_up_stack_bytes = stack_bytes;
+    m_warm_up_pending = pending;
+}
+
+inline void Worker::setPriorityQueue(MultiQueue<Task> *queue) {
+    m_priority_queue = queue;
+}
+
+inline void Worker::setSlabCache(SlabCache *cache) {
+    m_slab_cache = cache;
+}
+
+template <typename... Args>
+inline bool Worker::log(const char *format, Args... args) {
+    return m_log && m_log->write(_id, format, args...);
+}
+
+inline size_t Worker::getId() const {
+    return _id;
+}
+
+inline size_t Worker::getQueueSize() const {
+    return m_queue.size();
+}
+
+inline size_t Worker::getResidentMemory() const {
+    return sizeof(*this) + m_queue.getResidentMemory() + m_idle_queue.getResidentMemory()
+        + m_steal_donors.capacity() * sizeof(Worker *);
+}
+
+inline Worker *& Worker::currentRef() {
+    static thread_local Worker *worker = nullptr;
+    return worker;
+}
+
+inline Worker * Worker::current() {
+    return currentRef();
+}
+
+inline bool Worker::stealFromDonors(Task &task) {
+    return BalancingPolicy::steal(m_steal_donors.size(), m_steal_cursor, [this, &task](size_t donor) {
+        return m_steal_donors[donor]->steal(task);
+    });
+}
+
+// Compilers don't inline functions calling alloca(), so the memory is released on return.
+inline size_t Worker::getFreeStack() {
+    size_t free = SIZE_MAX;
+#if defined(__linux__)
+    const size_t margin = 64 * 1024;
+
+    pthread_attr_t attr;
+    if (0 == pthread_getattr_np(pthread_self(), &attr)) {
+        void *stack;
+        size_t size;
+        if (0 == pthread_attr_getstack(&attr, &stack, &size)) {
+            char here;
+            size_t below = static_cast<size_t>(&here - static_cast<char *>(stack));
+            free = below > margin ? below - margin : 0;
+        }
+        pthread_attr_destroy(&attr);
+    }
+#endif
+    return free;
+}
+
+inline void Worker::prefaultStack(size_t bytes) {
+    bytes = std::min(bytes, getFreeStack());
+    if (0 == bytes) {
+        return;
+    }
+
+    volatile char *stack = static_cast<volatile char *>(alloca(bytes));
+    for (size_t offset = 0; offset < bytes; offset += 4096) {
+        stack[offset] = 0;
+    }
+    stack[bytes - 1] = 0;
+}
+
+inline void Worker::warmUp() {
+    if (m_warm_up_stack_bytes) {
+        prefaultStack(m_warm_up_stack_bytes);
+    }
+    m_queue.prefault();
+
+    if (m_slab_cache) {
+        for (size_t size = SlabCache::MinBlockSize; size <= SlabCache::MaxBlockSize; size <<= 1) {
+            SlabAllocator::deallocate(SlabAllocator::allocate(size));
+        }
+    }
+
+    Task task([](WorkerContext &context) { context.random(); });
+    task(m_context);
+
+    m_warm_up_pending->fetch_sub(1, std::memory_order_acq_rel);
+    while (m_warm_up_pending->load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+inline bool Worker::popTask(Task &task) {
+    if (m_has_lookahead_task) {
+        task = std::move(m_lookahead_task);
+        m_has_lookahead_task = false;
+    } else if (!m_queue.pop(task) && !popIntrusive(task)
+               && !(m_priority_queue && m_priority_queue->pop(task)) && !stealFromDonors(task)) {
+        return false;
+    }
+
+    if (m_lookahead && (m_queue.pop(m_lookahead_task) || popIntrusive(m_lookahead_task)
+                        || (m_priority_queue && m_priority_queue->pop(m_lookahead_task)))) {
+        m_has_lookahead_task = true;
+        m_lookahead_task.prefetch();
+    }
+    return true;
+}
+
+inline bool Worker::popIntrusive(Task &task) {
+    struct Invoker {
+        IntrusiveTask *task;
+
+        void operator()(WorkerContext &context) {
+            task->run(context);
+        }
+
+        void prefetch() {
+            task->prefetch();
+        }
+    };
+
+    IntrusiveNode *node = m_intrusive_queue.pop();
+    if (!node) {
+        return false;
+    }
+    task = Task(Invoker{static_cast<IntrusiveTask *>(node)});
+    return true;
+}
+
+inline bool Worker::stealIdleFromDonors(Task &task) {
+    for (Worker *donor : m_steal_donors) {
+        if (donor->m_idle_queue.pop(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Worker::runTask(Task &task, bool idle) {
+    m_preempt_requested.store(false, std::memory_order_relaxed);
+    if (idle) {
+        m_running_idle.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_queue.size() != 0 || !m_intrusive_queue.empty()) {
+            requestPreempt();
+        }
+    }
+    if (m_track_task_start) {
+        m_task_start.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+    }
+    try {task(m_context);} catch (...) {}
+    task = Task();
+    if (m_track_task_start) {
+        m_task_start.store(0, std::memory_order_relaxed);
+    }
+    if (idle) {
+        m_running_idle.store(false, std::memory_order_relaxed);
+    }
+    m_task_count.store(m_task_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (m_graveyard.overloaded()) {
+        m_graveyard.drain(Graveyard::BatchSize);
+    }
+}
+
+inline void Worker::threadFunc(OnStart onStart, OnStop onStop) {
+    currentRef() = this;
+    SlabCache::setCurrent(m_slab_cache);
+    Graveyard::setCurrent(&m_graveyard);
+    if (m_qsbr) {
+        m_qsbr->online(_id);
+    }
+
+    if (m_warm_up_pending) {
+        warmUp();
+    }
+
     if (onStart) {
         try { onStart(_id); } catch (...) {}
     }
 
     Task handler;
 
-    while (m_running_flag.load(std::memory_order_relaxed))
-        if (m_queue.pop(handler) || steal_donor->steal(handler)) {
-            try {handler(_id);} catch (...) {}
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    while (m_running_flag.load(std::memory_order_relaxed)) {
+        if (popTask(handler)) {
+            runTask(handler, false);
+        } else if (m_idle_queue.pop(handler) || stealIdleFromDonors(handler)) {
+            runTask(handler, true);
+        } else if (m_graveyard.drain(Graveyard::BatchSize) == 0) {
+            if (m_slab_cache) {
+                m_slab_cache->collect();
+            }
+            if (!m_busy_poll) {
+                std::this_thread::sleep_for(BalancingPolicy::idleSleep());
+            }
+        }
+
+        if (m_qsbr) {
+            m_qsbr->quiescent(_id);
         }
-        
+    }
+
     if (onStop) {
         try { onStop(_id); } catch (...) {}
     }
+
+    if (m_qsbr) {
+        m_qsbr->offline(_id);
+    }
+
+    m_lookahead_task = Task();
+
+    Graveyard::setCurrent(nullptr);
+    m_graveyard.drain(m_graveyard.size());
+
+    if (m_slab_cache) {
+        m_slab_cache->collect();
+    }
+    SlabCache::setCurrent(nullptr);
+    currentRef() = nullptr;
+}
+
+inline WorkerContext::WorkerContext(Worker &worker, size_t id)
+    : m_worker(&worker)
+    , m_id(id) {
+}
+
+inline WorkerContext::operator size_t() const {
+    return m_id;
+}
+
+inline size_t WorkerContext::getId() const {
+    return m_id;
+}
+
+template <typename Handler>
+inline bool WorkerContext::post(Handler &&handler) {
+    return m_worker->post(std::forward<Handler>(handler));
+}
+
+template <typename... Args>
+inline bool WorkerContext::log(const char *format, Args... args) {
+    return m_worker->log(format, args...);
+}
+
+inline uint64_t WorkerContext::random() {
+    uint64_t x = m_worker->m_random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    m_worker->m_random_state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+inline size_t WorkerContext::getTaskCount() const {
+    return m_worker->m_task_count.load(std::memory_order_relaxed);
+}
+
+inline bool WorkerContext::preemptRequested() const {
+    return m_worker->m_preempt_requested.load(std::memory_order_relaxed)
+        || !m_worker->m_running_flag.load(std::memory_order_relaxed);
+}
+
+inline void *& WorkerContext::userData() {
+    return m_worker->m_user_data;
 }
 
 #endif